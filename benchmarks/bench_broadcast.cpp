@@ -0,0 +1,119 @@
+#include "./benchmark.hpp"
+
+#include <asynchronous_server.h>
+#include <asynchronous_client.h>
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <betabugs/networking/thrift_asio_client.hpp>
+#include <betabugs/networking/thrift_asio_connection_management_mixin.hpp>
+#include <memory>
+
+/*!
+* Fan-out of thrift_asio_connection_management_mixin::broadcast: one client calls
+* test::asynchronous_server::add in batches, the server broadcasts every result to
+* num_listeners other clients. An item is one broadcast, it is done, when every listener
+* received it.
+* */
+
+namespace {
+
+class broadcasting_server_handler : public test::asynchronous_serverIf
+								  , public betabugs::networking::thrift_asio_transport::event_handlers
+								  , public betabugs::networking::thrift_asio_connection_management_mixin<test::asynchronous_clientClient>
+{
+  public:
+	virtual void add(const int32_t a, const int32_t b) override
+	{
+		broadcast([&](test::asynchronous_clientClient& client){ client.on_added(a + b); }, current_client_);
+	}
+
+	size_t num_clients()
+	{
+		std::lock_guard<std::mutex> lock(clients_mutex_);
+		return clients_.size();
+	}
+};
+
+class counting_client_handler : public betabugs::networking::thrift_asio_client<
+	test::asynchronous_serverClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::asynchronous_serverClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf
+	>::thrift_asio_client;
+
+	uint64_t num_results = 0;
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+		++num_results;
+	}
+
+	void add(int32_t a, int32_t b)
+	{
+		client_.add(a, b);
+	}
+};
+
+void bench_fanout(benchmarks::report& report, size_t num_listeners, uint64_t num_broadcasts, uint64_t batch_size)
+{
+	boost::asio::io_service io_service;
+
+	auto handler = boost::make_shared<broadcasting_server_handler>();
+	test::asynchronous_serverProcessor processor(handler);
+	auto acceptor = betabugs::networking::thrift_asio_server<broadcasting_server_handler>::serve(io_service, processor, handler, 0);
+	const auto port = std::to_string(acceptor->local_endpoint().port());
+
+	std::vector<std::unique_ptr<counting_client_handler>> listeners;
+	for (size_t i = 0; i < num_listeners; ++i)
+		listeners.emplace_back(new counting_client_handler(io_service, "127.0.0.1", port));
+	benchmarks::poll_until(io_service, [&]{ return handler->num_clients() == num_listeners; });
+
+	counting_client_handler sender(io_service, "127.0.0.1", port);
+	benchmarks::poll_until(io_service, [&]{ return handler->num_clients() == num_listeners + 1; });
+
+	benchmarks::result r;
+	r.name = "fanout/" + std::to_string(num_listeners);
+	benchmarks::measurement m;
+
+	for (uint64_t sent = 0; sent < num_broadcasts; )
+	{
+		for (uint64_t i = 0; i < batch_size && sent < num_broadcasts; ++i, ++sent)
+			sender.add(1, 2);
+
+		benchmarks::poll_until(io_service, [&]
+		{
+			bool is_done = true;
+			for (auto& listener : listeners)
+			{
+				listener->update();
+				is_done = is_done && listener->num_results == sent;
+			}
+			return is_done;
+		});
+	}
+
+	m.stop(r);
+	r.iterations = num_broadcasts;
+	report.add(r);
+
+	acceptor->close();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	benchmarks::report report("bench_broadcast", argc, argv);
+
+	for (size_t num_listeners : {1, 16, 128})
+		bench_fanout(report, num_listeners, report.iterations(2000000 / (num_listeners + 1)), 64);
+
+	report.write();
+	return 0;
+}
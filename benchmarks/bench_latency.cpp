@@ -0,0 +1,136 @@
+#include "./benchmark.hpp"
+
+#include <synchronous_service.h>
+#include <asynchronous_client.h>
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <betabugs/networking/thrift_asio_client.hpp>
+
+/*!
+* Latency of request/response calls: test::synchronous_service::add is called with
+* thrift_asio_client::async_call, keeping depth calls outstanding. The latency of a call
+* is the time from sending it until its completion handler is called from update().
+* */
+
+namespace {
+
+class adding_service_handler : public test::synchronous_serviceIf
+							 , public betabugs::networking::thrift_asio_transport::event_handlers
+{
+  public:
+	virtual int32_t add(const int32_t a, const int32_t b) override
+	{
+		return a + b;
+	}
+
+	// the callbacks without a connection context. The handler keeps no per connection state.
+	void on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		(void) output_protocol;
+	}
+
+	void on_client_disconnected(const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol, const boost::system::error_code& ec)
+	{
+		(void) output_protocol;
+		(void) ec;
+	}
+
+	void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		(void) output_protocol;
+	}
+
+	void after_process()
+	{
+	}
+};
+
+class calling_client_handler : public betabugs::networking::thrift_asio_client<
+	test::synchronous_serviceClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::synchronous_serviceClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf
+	>::thrift_asio_client;
+
+	bool is_connected = false;
+	uint64_t num_results = 0;
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+	}
+
+	virtual void on_connected() override
+	{
+		is_connected = true;
+	}
+
+	// calls add and records its latency, when the reply arrived
+	void add(benchmarks::latency_recorder& latencies)
+	{
+		auto start = benchmarks::clock::now();
+		async_call(
+			[](test::synchronous_serviceClient& c){ c.send_add(20, 22); },
+			[](test::synchronous_serviceClient& c){ return c.recv_add(); },
+			[this, start, &latencies](std::future<int32_t> result)
+			{
+				result.get();
+				latencies.add(benchmarks::clock::now() - start);
+				++num_results;
+			}
+		);
+	}
+};
+
+void bench_request_response(benchmarks::report& report, size_t depth, uint64_t num_calls)
+{
+	boost::asio::io_service io_service;
+
+	auto handler = boost::make_shared<adding_service_handler>();
+	test::synchronous_serviceProcessor processor(handler);
+	auto acceptor = betabugs::networking::thrift_asio_server<adding_service_handler>::serve(io_service, processor, handler, 0);
+
+	calling_client_handler client(io_service, "127.0.0.1", std::to_string(acceptor->local_endpoint().port()));
+	benchmarks::poll_until(io_service, [&]{ return client.is_connected; });
+
+	benchmarks::result r;
+	r.name = "request_response/depth/" + std::to_string(depth);
+	r.latencies.reserve(num_calls);
+	benchmarks::measurement m;
+
+	uint64_t sent = 0;
+	benchmarks::poll_until(io_service, [&]
+	{
+		client.update();
+		while (sent < num_calls && sent - client.num_results < depth)
+		{
+			client.add(r.latencies);
+			++sent;
+		}
+		return client.num_results == num_calls;
+	});
+
+	m.stop(r);
+	r.iterations = num_calls;
+	report.add(r);
+
+	acceptor->close();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	benchmarks::report report("bench_latency", argc, argv);
+
+	for (size_t depth : {1, 16})
+		bench_request_response(report, depth, report.iterations(100000));
+
+	report.write();
+	return 0;
+}
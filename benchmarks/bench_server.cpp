@@ -0,0 +1,118 @@
+#include "./benchmark.hpp"
+
+#include <asynchronous_server.h>
+#include <asynchronous_client.h>
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <betabugs/networking/thrift_asio_client.hpp>
+#include <betabugs/networking/thrift_asio_connection_management_mixin.hpp>
+
+/*!
+* The cost of dispatching one frame in thrift_asio_server: test::asynchronous_server::add
+* is called in batches, that are sent at once, and the time until the server handled
+* all of them is measured. With replies, the time until the client received all of them.
+*
+* Client and server run on the same io_service, so the allocations per item include
+* serializing the call on the client side.
+* */
+
+namespace {
+
+class counting_server_handler : public test::asynchronous_serverIf
+							  , public betabugs::networking::thrift_asio_transport::event_handlers
+							  , public betabugs::networking::thrift_asio_connection_management_mixin<test::asynchronous_clientClient>
+{
+  public:
+	uint64_t num_calls = 0;
+	bool reply = false;
+
+	virtual void add(const int32_t a, const int32_t b) override
+	{
+		++num_calls;
+		if (reply)
+			current_client_->on_added(a + b);
+	}
+};
+
+class counting_client_handler : public betabugs::networking::thrift_asio_client<
+	test::asynchronous_serverClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::asynchronous_serverClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf
+	>::thrift_asio_client;
+
+	uint64_t num_results = 0;
+	bool is_connected = false;
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+		++num_results;
+	}
+
+	virtual void on_connected() override
+	{
+		is_connected = true;
+	}
+
+	void add(int32_t a, int32_t b)
+	{
+		client_.add(a, b);
+	}
+};
+
+void bench_dispatch(benchmarks::report& report, bool reply, uint64_t num_calls, uint64_t batch_size)
+{
+	boost::asio::io_service io_service;
+
+	auto handler = boost::make_shared<counting_server_handler>();
+	handler->reply = reply;
+	test::asynchronous_serverProcessor processor(handler);
+	auto acceptor = betabugs::networking::thrift_asio_server<counting_server_handler>::serve(io_service, processor, handler, 0);
+
+	counting_client_handler client(io_service, "127.0.0.1", std::to_string(acceptor->local_endpoint().port()));
+	benchmarks::poll_until(io_service, [&]{ return client.is_connected; });
+
+	benchmarks::result r;
+	r.name = std::string(reply ? "dispatch/add_with_reply/" : "dispatch/add/") + std::to_string(batch_size);
+	benchmarks::measurement m;
+
+	for (uint64_t sent = 0; sent < num_calls; )
+	{
+		for (uint64_t i = 0; i < batch_size && sent < num_calls; ++i, ++sent)
+			client.add(1, 2);
+
+		benchmarks::poll_until(io_service, [&]
+		{
+			client.update();
+			return reply ? client.num_results == sent : handler->num_calls == sent;
+		});
+	}
+
+	m.stop(r);
+	r.iterations = num_calls;
+	report.add(r);
+
+	acceptor->close();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	benchmarks::report report("bench_server", argc, argv);
+
+	for (uint64_t batch_size : {1, 16, 256})
+	{
+		bench_dispatch(report, false, report.iterations(200000), batch_size);
+		bench_dispatch(report, true, report.iterations(200000), batch_size);
+	}
+
+	report.write();
+	return 0;
+}
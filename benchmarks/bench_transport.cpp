@@ -0,0 +1,150 @@
+#include "./benchmark.hpp"
+
+#include <betabugs/networking/thrift_asio_transport.hpp>
+#include <betabugs/networking/thrift_asio_framed_transport.hpp>
+#include <boost/make_shared.hpp>
+
+/*!
+* Throughput of thrift_asio_transport and thrift_asio_framed_transport over a loopback
+* tcp connection, with both ends on the same io_service.
+*
+* Messages are written, while less than max_queued_bytes are waiting to be sent,
+* and read, as soon as they arrived.
+* */
+
+namespace {
+
+using betabugs::networking::thrift_asio_transport;
+using betabugs::networking::thrift_asio_framed_transport;
+
+const size_t max_queued_bytes = 1024 * 1024;
+
+struct connection
+{
+	thrift_asio_transport::event_handlers handlers;
+	boost::shared_ptr<thrift_asio_transport> sender;
+	boost::shared_ptr<thrift_asio_transport> receiver;
+
+	explicit connection(boost::asio::io_service& io_service)
+	{
+		using boost::asio::ip::tcp;
+
+		tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		auto client_socket = std::make_shared<tcp::socket>(io_service);
+		auto server_socket = std::make_shared<tcp::socket>(io_service);
+		client_socket->connect(acceptor.local_endpoint());
+		acceptor.accept(*server_socket);
+
+		sender = boost::make_shared<thrift_asio_transport>(client_socket, &handlers);
+		receiver = boost::make_shared<thrift_asio_transport>(server_socket, &handlers);
+		sender->open();
+		receiver->open();
+	}
+
+	~connection()
+	{
+		sender->close();
+		receiver->close();
+	}
+};
+
+// writes the same shared_buffer over and over, so only the transport is measured
+void bench_shared_buffer(benchmarks::report& report, size_t message_size, uint64_t num_messages)
+{
+	boost::asio::io_service io_service;
+	connection c(io_service);
+
+	auto message = std::make_shared<const std::vector<uint8_t>>(message_size, uint8_t(42));
+	const uint64_t total_bytes = num_messages * message_size;
+	uint64_t sent = 0;
+	uint64_t received = 0;
+
+	benchmarks::result r;
+	r.name = "loopback/shared_buffer/" + std::to_string(message_size);
+	benchmarks::measurement m;
+
+	benchmarks::poll_until(io_service, [&]
+	{
+		while (sent < num_messages && c.sender->outbound_bytes() < max_queued_bytes)
+		{
+			c.sender->write(thrift_asio_transport::shared_buffer(message));
+			++sent;
+		}
+
+		auto available = uint32_t(c.receiver->available_bytes());
+		while (available > 0)
+		{
+			uint32_t len = available;
+			if (!c.receiver->borrow(nullptr, &len))
+				break;
+			len = std::min(len, available);
+			c.receiver->consume(len);
+			received += len;
+			available -= len;
+		}
+		return received == total_bytes;
+	});
+
+	m.stop(r);
+	r.iterations = num_messages;
+	r.bytes = received;
+	report.add(r);
+}
+
+// writes frames through thrift_asio_framed_transport and reads them back
+void bench_framed(benchmarks::report& report, size_t message_size, uint64_t num_messages)
+{
+	boost::asio::io_service io_service;
+	connection c(io_service);
+
+	thrift_asio_framed_transport writer(c.sender);
+	thrift_asio_framed_transport reader(c.receiver);
+
+	std::vector<uint8_t> payload(message_size, uint8_t(42));
+	std::vector<uint8_t> frame(message_size);
+	uint64_t sent = 0;
+	uint64_t received = 0;
+
+	benchmarks::result r;
+	r.name = "loopback/framed/" + std::to_string(message_size);
+	benchmarks::measurement m;
+
+	benchmarks::poll_until(io_service, [&]
+	{
+		while (sent < num_messages && c.sender->outbound_bytes() < max_queued_bytes)
+		{
+			writer.write(payload.data(), uint32_t(payload.size()));
+			writer.flush();
+			++sent;
+		}
+
+		while (reader.has_complete_frame())
+		{
+			reader.readAll(frame.data(), uint32_t(frame.size()));
+			++received;
+		}
+		return received == num_messages;
+	});
+
+	m.stop(r);
+	r.iterations = num_messages;
+	r.bytes = received * message_size;
+	report.add(r);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	benchmarks::report report("bench_transport", argc, argv);
+
+	for (size_t message_size : {64, 1024, 16 * 1024})
+	{
+		uint64_t num_messages = report.iterations(64 * 1024 * 1024 / message_size);
+		bench_shared_buffer(report, message_size, num_messages);
+		bench_framed(report, message_size, num_messages);
+	}
+
+	report.write();
+	return 0;
+}
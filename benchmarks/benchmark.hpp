@@ -0,0 +1,255 @@
+#ifndef _THRIFT_ASIO_BENCHMARK_HPP_
+#define _THRIFT_ASIO_BENCHMARK_HPP_
+
+#pragma once
+
+/*!
+* \file
+* Helpers shared by the benchmarks: timing, latency percentiles, allocation counting
+* and the report, that is written as JSON.
+*
+* Every benchmark is an executable of its own, that accepts
+*  - `--json <file>` to write the report to file instead of stdout
+*  - `--quick` to run a tenth of the iterations (i.e. as a smoke test)
+*
+* The report looks like this, so that it can be tracked over time:
+* @code
+* {"benchmark": "bench_transport", "results": [
+*   {"name": "loopback/1024", "iterations": 100000, "seconds": 0.21, "items_per_second": 476190,
+*    "bytes_per_second": 487619047, "allocations_per_item": 0.01, "p50_us": 0, "p99_us": 0, "p999_us": 0}
+* ]}
+* @endcode
+*
+* Include this header in exactly one translation unit per executable: it replaces the
+* global operator new and delete to count allocations.
+* */
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace benchmarks {
+
+/// the number of calls to operator new so far, in all threads
+inline std::atomic<uint64_t>& allocation_count()
+{
+	static std::atomic<uint64_t> count(0);
+	return count;
+}
+
+typedef std::chrono::steady_clock clock;
+
+/// collects per item latencies and computes percentiles of them
+class latency_recorder
+{
+  public:
+	void reserve(size_t n)
+	{
+		samples_.reserve(n);
+	}
+
+	void add(clock::duration latency)
+	{
+		samples_.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+	}
+
+	bool empty() const
+	{
+		return samples_.empty();
+	}
+
+	/// the latency in microseconds, that p (0..1) of the samples did not exceed
+	double percentile(double p)
+	{
+		if (samples_.empty())
+			return 0;
+
+		std::sort(samples_.begin(), samples_.end());
+		auto index = std::min(samples_.size() - 1, size_t(p * double(samples_.size())));
+		return double(samples_[index]) / 1000.0;
+	}
+
+  private:
+	std::vector<int64_t> samples_;
+};
+
+/// the outcome of one benchmark run
+struct result
+{
+	std::string name;
+	uint64_t iterations = 0;  ///< items processed, i.e. messages or requests
+	uint64_t bytes = 0;       ///< payload bytes processed, if meaningful
+	double seconds = 0;
+	uint64_t allocations = 0;
+	latency_recorder latencies;
+};
+
+/// measures time and allocations between construction and stop()
+class measurement
+{
+  public:
+	measurement()
+		: allocations_(allocation_count())
+		, start_(clock::now())
+	{
+	}
+
+	/// fills in seconds and allocations of r
+	void stop(result& r) const
+	{
+		r.seconds = std::chrono::duration<double>(clock::now() - start_).count();
+		r.allocations = allocation_count() - allocations_;
+	}
+
+  private:
+	uint64_t allocations_;
+	clock::time_point start_;
+};
+
+/// collects the results of a benchmark executable and writes them as JSON
+class report
+{
+  public:
+	report(const std::string& benchmark, int argc, char** argv)
+		: benchmark_(benchmark)
+		, scale_(1)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+				json_path_ = argv[++i];
+			else if (std::strcmp(argv[i], "--quick") == 0)
+				scale_ = 10;
+		}
+	}
+
+	/// n, reduced by --quick
+	uint64_t iterations(uint64_t n) const
+	{
+		return std::max<uint64_t>(1, n / scale_);
+	}
+
+	/// prints a summary of r to std::clog and keeps it for the JSON report
+	void add(result& r)
+	{
+		entry e;
+		e.name = r.name;
+		e.iterations = r.iterations;
+		e.seconds = r.seconds;
+		e.items_per_second = r.seconds > 0 ? double(r.iterations) / r.seconds : 0;
+		e.bytes_per_second = r.seconds > 0 ? double(r.bytes) / r.seconds : 0;
+		e.allocations_per_item = r.iterations > 0 ? double(r.allocations) / double(r.iterations) : 0;
+		e.p50_us = r.latencies.percentile(0.5);
+		e.p99_us = r.latencies.percentile(0.99);
+		e.p999_us = r.latencies.percentile(0.999);
+		entries_.push_back(e);
+
+		std::clog << benchmark_ << "/" << e.name
+			<< ": " << e.items_per_second << " items/s"
+			<< ", " << e.bytes_per_second / (1024 * 1024) << " MiB/s"
+			<< ", " << e.allocations_per_item << " allocations/item";
+		if (!r.latencies.empty())
+			std::clog << ", p50 " << e.p50_us << "us, p99 " << e.p99_us << "us, p999 " << e.p999_us << "us";
+		std::clog << std::endl;
+	}
+
+	/// writes the JSON report to the file given by --json or to stdout
+	void write() const
+	{
+		if (json_path_.empty())
+		{
+			write(std::cout);
+			return;
+		}
+
+		std::ofstream file(json_path_);
+		write(file);
+	}
+
+  private:
+	struct entry
+	{
+		std::string name;
+		uint64_t iterations;
+		double seconds;
+		double items_per_second;
+		double bytes_per_second;
+		double allocations_per_item;
+		double p50_us;
+		double p99_us;
+		double p999_us;
+	};
+
+	std::string benchmark_;
+	std::string json_path_;
+	uint64_t scale_;
+	std::vector<entry> entries_;
+
+	void write(std::ostream& out) const
+	{
+		out << "{\"benchmark\": \"" << benchmark_ << "\", \"results\": [";
+		for (size_t i = 0; i < entries_.size(); ++i)
+		{
+			const entry& e = entries_[i];
+			out << (i == 0 ? "\n" : ",\n")
+				<< "  {\"name\": \"" << e.name << "\""
+				<< ", \"iterations\": " << e.iterations
+				<< ", \"seconds\": " << e.seconds
+				<< ", \"items_per_second\": " << e.items_per_second
+				<< ", \"bytes_per_second\": " << e.bytes_per_second
+				<< ", \"allocations_per_item\": " << e.allocations_per_item
+				<< ", \"p50_us\": " << e.p50_us
+				<< ", \"p99_us\": " << e.p99_us
+				<< ", \"p999_us\": " << e.p999_us
+				<< "}";
+		}
+		out << "\n]}" << std::endl;
+	}
+};
+
+/// runs io_service until done() returns true. Throws std::runtime_error after timeout.
+template <typename Done>
+void poll_until(boost::asio::io_service& io_service, Done done, std::chrono::seconds timeout = std::chrono::seconds(30))
+{
+	auto deadline = clock::now() + timeout;
+	while (!done())
+	{
+		if (clock::now() > deadline)
+			throw std::runtime_error("benchmark timed out");
+		if (io_service.poll() == 0)
+			std::this_thread::yield();
+	}
+}
+
+}
+
+// gcc sees the malloc in operator new, when it inlines it, and warns about the free below
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#	pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+	++benchmarks::allocation_count();
+	if (void* p = std::malloc(size == 0 ? 1 : size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+#endif //_THRIFT_ASIO_BENCHMARK_HPP_
@@ -50,11 +50,10 @@ class chat_server_handler
 	virtual void broadcast_message(const std::string& message) override
 	{
 		assert(current_client_);
-		for (auto& s : clients_)
-		{
-			if (s.second != current_client_)
-				s.second->client.on_message(current_client_->user_name, message);
-		}
+		const auto& user_name = current_client_->user_name;
+
+		// serialize the message once and send it to everybody else
+		broadcast([&](session& s){ s.client.on_message(user_name, message); }, current_client_);
 	}
 };
 
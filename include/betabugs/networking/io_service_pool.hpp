@@ -0,0 +1,104 @@
+#ifndef _THRIFT_ASIO_IO_SERVICE_POOL_HPP_
+#define _THRIFT_ASIO_IO_SERVICE_POOL_HPP_
+
+#pragma once
+
+#include <boost/asio/io_service.hpp>
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace betabugs {
+namespace networking {
+
+/*!
+* A pool of io_services, that are run by one thread each.
+*
+* This is the building block for a sharded server (see thrift_asio_server::serve):
+* every connection lives on exactly one io_service (its shard), so connections on
+* different shards never contend for the same reactor.
+*
+* @code
+* betabugs::networking::io_service_pool pool; // one shard per core
+* thrift_asio_server<my_handler>::serve(pool, processor, handler, port);
+* pool.run(); // blocks until pool.stop() is called
+* @endcode
+* */
+class io_service_pool
+{
+  public:
+	/// creates pool_size io_services. Uses one per core, if pool_size is zero.
+	explicit io_service_pool(size_t pool_size = 0)
+		: next_io_service_(0)
+	{
+		if (pool_size == 0)
+			pool_size = std::max(1u, std::thread::hardware_concurrency());
+
+		for (size_t i = 0; i < pool_size; ++i)
+		{
+			// every io_service is only run by a single thread
+			io_services_.emplace_back(new boost::asio::io_service(1));
+			work_.emplace_back(new boost::asio::io_service::work(*io_services_.back()));
+		}
+	}
+
+	io_service_pool(const io_service_pool&) = delete;
+	io_service_pool& operator=(const io_service_pool&) = delete;
+
+	/// the number of io_services (shards)
+	size_t size() const
+	{
+		return io_services_.size();
+	}
+
+	/// the io_service of the shard with the given index
+	boost::asio::io_service& get_io_service(size_t index)
+	{
+		assert(index < io_services_.size());
+		return *io_services_[index];
+	}
+
+	/// returns the io_services in a round-robin fashion
+	/*!
+	* Must only be called from one thread at a time, i.e. from an accept handler.
+	* */
+	boost::asio::io_service& next_io_service()
+	{
+		auto& io_service = *io_services_[next_io_service_];
+		next_io_service_ = (next_io_service_ + 1) % io_services_.size();
+		return io_service;
+	}
+
+	/// runs every io_service on its own thread. Blocks until all of them are stopped.
+	void run()
+	{
+		std::vector<std::thread> threads;
+		for (auto& io_service : io_services_)
+		{
+			auto& s = *io_service;
+			threads.emplace_back([&s]{ s.run(); });
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	/// stops all io_services. Can be called from any thread.
+	void stop()
+	{
+		for (auto& io_service : io_services_)
+			io_service->stop();
+	}
+
+  private:
+	std::vector<std::unique_ptr<boost::asio::io_service>> io_services_;
+	std::vector<std::unique_ptr<boost::asio::io_service::work>> work_;
+	size_t next_io_service_;
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_IO_SERVICE_POOL_HPP_
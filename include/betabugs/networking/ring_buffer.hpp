@@ -0,0 +1,232 @@
+#ifndef _THRIFT_ASIO_RING_BUFFER_HPP_
+#define _THRIFT_ASIO_RING_BUFFER_HPP_
+
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace betabugs {
+namespace networking {
+
+/*!
+* A contiguous, growable byte ring buffer.
+*
+* The capacity is always a power of two, so wrapping around is a simple mask.
+* Data is appended at the tail and consumed from the head. The readable bytes are
+* at most split into two spans (the part up to the end of the storage and the
+* wrapped around part at the beginning), so reads are at most two memcpy's.
+*
+* Free space can be handed out as a mutable buffer sequence (see prepare()) so that
+* the socket can receive straight into the buffer. The storage is only ever reallocated
+* by reserve() and shrink_to(), so the spans returned by prepare() stay valid while the
+* head is consumed.
+* */
+class ring_buffer
+{
+  public:
+	/// the two spans of free space, suitable for boost::asio::async_read_some and friends
+	typedef std::array<boost::asio::mutable_buffer, 2> mutable_buffers_type;
+
+	/// creates a ring_buffer with at least initial_capacity bytes of storage
+	explicit ring_buffer(size_t initial_capacity = 4096)
+		: storage_()
+		, capacity_(0)
+		, head_(0)
+		, size_(0)
+	{
+		reserve(initial_capacity);
+	}
+
+	ring_buffer(const ring_buffer&) = delete;
+	ring_buffer& operator=(const ring_buffer&) = delete;
+
+	/// number of readable bytes
+	size_t size() const
+	{
+		return size_;
+	}
+
+	/// total number of bytes that fit into the buffer without growing
+	size_t capacity() const
+	{
+		return capacity_;
+	}
+
+	/// number of bytes that can be appended without growing
+	size_t free_space() const
+	{
+		return capacity_ - size_;
+	}
+
+	/// true, if there are no readable bytes
+	bool empty() const
+	{
+		return size_ == 0;
+	}
+
+	/// discards all readable bytes. Does not release the storage.
+	void clear()
+	{
+		head_ = 0;
+		size_ = 0;
+	}
+
+	/// makes sure, that at least n bytes can be appended without reallocation
+	/*!
+	* Invalidates all spans previously returned by prepare() and data().
+	* */
+	void reserve(size_t n)
+	{
+		if (free_space() >= n && storage_)
+			return;
+
+		size_t new_capacity = capacity_ ? capacity_ : 1;
+		while (new_capacity - size_ < n)
+			new_capacity *= 2;
+
+		reallocate(new_capacity);
+	}
+
+	/// releases storage, so that the capacity is the smallest power of two >= max(size(), n)
+	/*!
+	* Invalidates all spans previously returned by prepare() and data().
+	* */
+	void shrink_to(size_t n)
+	{
+		size_t new_capacity = 1;
+		while (new_capacity < std::max(size_, n))
+			new_capacity *= 2;
+
+		if (new_capacity < capacity_)
+			reallocate(new_capacity);
+	}
+
+	/// appends len bytes from data, growing the buffer if necessary
+	void append(const uint8_t* data, size_t len)
+	{
+		reserve(len);
+
+		auto spans = prepare(len);
+		auto first = std::min(len, boost::asio::buffer_size(spans[0]));
+		std::memcpy(boost::asio::buffer_cast<uint8_t*>(spans[0]), data, first);
+		std::memcpy(boost::asio::buffer_cast<uint8_t*>(spans[1]), data + first, len - first);
+		commit(len);
+	}
+
+	/// returns up to n bytes of free space as (at most) two spans
+	/*!
+	* Nothing is appended, until commit() is called.
+	* The caller is responsible to call reserve() first, if n bytes are needed.
+	* */
+	mutable_buffers_type prepare(size_t n)
+	{
+		n = std::min(n, free_space());
+		auto tail = (head_ + size_) & (capacity_ - 1);
+		auto first = std::min(n, capacity_ - tail);
+
+		return {{
+			boost::asio::buffer(storage_.get() + tail, first),
+			boost::asio::buffer(storage_.get(), n - first)
+		}};
+	}
+
+	/// makes n bytes, that were written into the spans returned by prepare(), readable
+	void commit(size_t n)
+	{
+		assert(n <= free_space());
+		size_ += n;
+	}
+
+	/// the readable bytes, that are stored contiguously at the head of the buffer
+	/*!
+	* @param len is set to the number of contiguous bytes (might be less than size())
+	* @returns a pointer to the first readable byte
+	* */
+	const uint8_t* data(size_t* len) const
+	{
+		*len = std::min(size_, capacity_ - head_);
+		return storage_.get() + head_;
+	}
+
+	/// \copydoc data(size_t*) const
+	uint8_t* data(size_t* len)
+	{
+		*len = std::min(size_, capacity_ - head_);
+		return storage_.get() + head_;
+	}
+
+	/// discards n bytes from the head of the buffer
+	/*!
+	* The head is not rewound, when the buffer becomes empty: a receive into the
+	* spans returned by prepare() might still be pending, and its bytes have to
+	* follow the consumed ones.
+	* */
+	void consume(size_t n)
+	{
+		assert(n <= size_);
+		head_ = (head_ + n) & (capacity_ - 1);
+		size_ -= n;
+	}
+
+	/// copies up to len bytes into dst without consuming them
+	/*!
+	* @returns the number of bytes copied
+	* */
+	size_t peek(uint8_t* dst, size_t len) const
+	{
+		len = std::min(len, size_);
+		copy_out(dst, len);
+		return len;
+	}
+
+	/// copies up to len bytes into dst and consumes them
+	/*!
+	* @returns the number of bytes copied
+	* */
+	size_t read(uint8_t* dst, size_t len)
+	{
+		len = peek(dst, len);
+		consume(len);
+		return len;
+	}
+
+  private:
+	std::unique_ptr<uint8_t[]> storage_;
+	size_t capacity_;
+	size_t head_;
+	size_t size_;
+
+	void reallocate(size_t new_capacity)
+	{
+		assert(new_capacity >= size_);
+		std::unique_ptr<uint8_t[]> new_storage(new uint8_t[new_capacity]);
+		copy_out(new_storage.get(), size_);
+
+		storage_ = std::move(new_storage);
+		capacity_ = new_capacity;
+		head_ = 0;
+	}
+
+	// copies the first len readable bytes to dst with at most two memcpy's
+	void copy_out(uint8_t* dst, size_t len) const
+	{
+		assert(len <= size_);
+		if (len == 0)
+			return;
+
+		auto first = std::min(len, capacity_ - head_);
+		std::memcpy(dst, storage_.get() + head_, first);
+		std::memcpy(dst + first, storage_.get(), len - first);
+	}
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_RING_BUFFER_HPP_
@@ -7,11 +7,22 @@
 
 #pragma once
 
+#include <boost/asio/deadline_timer.hpp>
 #include <boost/smart_ptr/enable_shared_from_raw.hpp>
 #include "./thrift_asio_client_transport.hpp"
-#include <thrift/protocol/TBinaryProtocol.h>
+#include "./thrift_asio_coroutine.hpp"
+#include "./thrift_asio_framed_transport.hpp"
+#include "./thrift_asio_log.hpp"
+#include "./thrift_asio_protocols.hpp"
+#include <thrift/TApplicationException.h>
 #include <thrift/transport/TBufferTransports.h>
-#include <thrift/transport/TZlibTransport.h>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 namespace betabugs {
 namespace networking {
@@ -23,13 +34,19 @@ namespace networking {
 * @tparam ClientType type of the auto-generated client. i.e. MyAwesomeServerClient
 * @tparam ProcessorType an auto-generated TProcessor, that works with HandlerInterfaceType. i.e. MyAwesomeClientProcessor
 * @tparam HandlerInterfaceType auto-generated interface of the handler you're implementing. i.e. MyAwesomeClientIf
-* @tparam use_compression whether to wrap the transport into a TZlibTransport or not
+* @tparam use_compression whether to compress frames with zlib by default (see default_compression())
+* @tparam ProtocolPolicy the thrift protocol, i.e. binary_protocol or compact_protocol (see thrift_asio_protocols.hpp)
+*
+* Calling a function, that is not oneway, on client_ blocks until the reply has arrived.
+* Use async_call() instead, to pipeline calls and receive the replies in update(),
+* or co_call() to await them in a C++20 coroutine.
 * */
 template<
 	typename ClientType,
 	typename ProcessorType,
 	typename HandlerInterfaceType,
-	bool use_compression=false
+	bool use_compression=false,
+	typename ProtocolPolicy=binary_protocol
 >
 class thrift_asio_client
 	: public HandlerInterfaceType
@@ -41,44 +58,195 @@ class thrift_asio_client
 	thrift_asio_client(
 		boost::asio::io_service& io_service,
 		const std::string& host_name,
-		const std::string& service_name
+		const std::string& service_name,
+		const thrift_asio_transport::receive_buffer_options& options
+			= thrift_asio_transport::receive_buffer_options(),
+		const compression_options& compression = default_compression()
 	)
 		: io_service_(io_service)
 		, processor_(boost::shared_from_raw(this))
+		, compression_(compression)
+		, transport_events_(*this)
 		, transport_(boost::make_shared<thrift_asio_client_transport>(
-			io_service, host_name, service_name, this
+			io_service, host_name, service_name, &transport_events_, options
 		))
-		, input_protocol_ (make_input_protocol(transport_))
-		, output_protocol_(make_output_protocol(transport_))
+		, input_protocol_ (make_framed_protocol(transport_, compression_))
+		, output_protocol_(make_framed_protocol(transport_, compression_))
+		, frame_buffer_(boost::make_shared<apache::thrift::transport::TMemoryBuffer>())
+		, frame_protocol_(boost::make_shared<memory_protocol_type>(frame_buffer_))
+		, call_buffer_(boost::make_shared<apache::thrift::transport::TMemoryBuffer>())
+		, call_protocol_(boost::make_shared<memory_protocol_type>(call_buffer_))
+		, async_client_(frame_protocol_, call_protocol_)
+		, next_seqid_(0)
 		, client_(input_protocol_, output_protocol_)
 	{
 		input_protocol_->getTransport()->open();
 	}
 
+	/// zlib, if use_compression is set. No compression otherwise.
+	static compression_options default_compression()
+	{
+		compression_options options;
+		if (use_compression)
+			options.codec = compression_codec::zlib;
+		return options;
+	}
+
 	/// process incoming traffic
+	/*!
+	* Only frames, that were received completely, are dispatched, so this never blocks
+	* and never runs the io_service. The rest is processed by a later call.
+	* */
 	void update()
 	{
-		while (transport_->isOpen() && transport_->peek())
+		while (has_complete_frame())
 		{
-			processor_.process(input_protocol_, nullptr, nullptr);
+			dispatch_frame();
 		}
 	}
 
-	/// process at most one incoming RPC call
+	/// process at most one incoming RPC call. Never blocks, like update().
 	void update_one()
 	{
-		if (transport_->isOpen() && transport_->peek())
+		update_n(1);
+	}
+
+	/// the outcome of update_n() and update_for()
+	struct update_result
+	{
+		size_t processed;     ///< the number of RPC calls, that were processed
+		size_t pending_bytes; ///< received bytes, that were not processed yet (might be a partial frame)
+		bool backlog;         ///< true, if at least one more call could have been processed right away
+	};
+
+	/// process at most max_calls incoming RPC calls. Never blocks, like update().
+	update_result update_n(size_t max_calls)
+	{
+		size_t processed = 0;
+		while (processed < max_calls && has_complete_frame())
 		{
-			processor_.process(input_protocol_, nullptr, nullptr);
+			dispatch_frame();
+			++processed;
 		}
+		return make_update_result(processed);
+	}
+
+	/// process incoming RPC calls, until budget has elapsed or there are no more
+	/*!
+	* The deadline is checked before each call, so a single slow handler can exceed it.
+	* Never blocks, like update().
+	*
+	* @code
+	* auto result = client.update_for(std::chrono::milliseconds(2));
+	* if (result.backlog) { ... } // falling behind
+	* @endcode
+	* */
+	template <typename Rep, typename Period>
+	update_result update_for(const std::chrono::duration<Rep, Period>& budget)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + budget;
+
+		size_t processed = 0;
+		while (std::chrono::steady_clock::now() < deadline && has_complete_frame())
+		{
+			dispatch_frame();
+			++processed;
+		}
+		return make_update_result(processed);
+	}
+
+	/// the type returned by a Receive function of async_call()
+	template <typename Receive>
+	using reply_type = decltype(std::declval<Receive&>()(std::declval<ClientType&>()));
+
+	/// sends a call without waiting for the reply. The returned future becomes ready in update().
+	/*!
+	* send is invoked with a ClientType, that serializes the call, receive with one,
+	* that deserializes the reply. Use the send_ and recv_ functions of the generated client:
+	*
+	* @code
+	* auto sum = client.async_call(
+	*   [](MyServerClient& c){ c.send_add(20, 22); },
+	*   [](MyServerClient& c){ return c.recv_add(); }
+	* );
+	* // ... client.update() ...
+	* if (sum.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	*   std::cout << sum.get() << std::endl;
+	* @endcode
+	*
+	* Every call gets its own sequence id, so any number of calls can be outstanding and the
+	* replies are matched to them in whatever order they arrive. Exceptions thrown by receive
+	* (i.e. declared exceptions of the function or TApplicationException) are stored in the future.
+	* Calls, that are pending when the connection fails or is closed, fail with a TTransportException,
+	* before on_error() or on_disconnected() is invoked. As do calls, that are pending when the
+	* connection is replaced by connect_to() or reconnect_in().
+	*
+	* Oneway functions have no reply. Pass a receive, that returns void, i.e. [](MyServerClient&){},
+	* and the future is ready, once the call was sent. A receive, that returns a value, fails with
+	* a TApplicationException for them.
+	*
+	* Never wait on the future in the thread, that calls update(). It would never become ready.
+	* */
+	template <typename Send, typename Receive>
+	std::future<reply_type<Receive>> async_call(Send send, Receive receive)
+	{
+		typedef reply_type<Receive> result_type;
+
+		auto promise = std::make_shared<std::promise<result_type>>();
+		if (!send_call(send, [promise, receive](ClientType* reply)
+		{
+			fulfill(*promise, receive, reply);
+		}))
+		{
+			fulfill_oneway(*promise);
+		}
+		return promise->get_future();
+	}
+
+	/// like async_call(send, receive), but calls complete with the ready future from within update()
+	template <typename Send, typename Receive, typename Complete>
+	void async_call(Send send, Receive receive, Complete complete)
+	{
+		typedef reply_type<Receive> result_type;
+
+		if (!send_call(send, [receive, complete](ClientType* reply)
+		{
+			std::promise<result_type> promise;
+			fulfill(promise, receive, reply);
+			complete(promise.get_future());
+		}))
+		{
+			std::promise<result_type> promise;
+			fulfill_oneway(promise);
+			complete(promise.get_future());
+		}
+	}
+
+#ifdef THRIFT_ASIO_HAS_COROUTINES
+	/// like async_call(send, receive), but awaitable from a C++20 coroutine (see thrift_asio_coroutine.hpp)
+	/*!
+	* The coroutine is resumed from within update(), with the reply or the exception of receive.
+	* */
+	template <typename Send, typename Receive>
+	call_awaiter<thrift_asio_client, Send, Receive> co_call(Send send, Receive receive)
+	{
+		return call_awaiter<thrift_asio_client, Send, Receive>(*this, std::move(send), std::move(receive));
+	}
+#endif
+
+	/// the number of calls sent by async_call(), that are still waiting for a reply
+	size_t pending_calls() const
+	{
+		return pending_calls_.size();
 	}
 
 	/// close the connection and connect to host_name:service_name
 	void connect_to(const std::string& host_name, const std::string service_name)
 	{
-		input_protocol_  = make_input_protocol(transport_);
-		output_protocol_ = make_output_protocol(transport_);
+		input_protocol_  = make_framed_protocol(transport_, compression_);
+		output_protocol_ = make_framed_protocol(transport_, compression_);
 		client_ = ClientType(input_protocol_, output_protocol_);
+		fail_pending_calls();
 
 		transport_->connect_to(host_name, service_name);
 	}
@@ -86,9 +254,10 @@ class thrift_asio_client
 	/// reconnect in seconds seconds
 	void reconnect_in(const boost::posix_time::time_duration& duration)
 	{
-		input_protocol_  = make_input_protocol(transport_);
-		output_protocol_ = make_output_protocol(transport_);
+		input_protocol_  = make_framed_protocol(transport_, compression_);
+		output_protocol_ = make_framed_protocol(transport_, compression_);
 		client_ = ClientType(input_protocol_, output_protocol_);
+		fail_pending_calls();
 
 		reconnect_timer = std::make_shared<boost::asio::deadline_timer>(io_service_);
 		reconnect_timer->expires_from_now(duration);
@@ -102,8 +271,58 @@ class thrift_asio_client
 	}
 
   private:
+	typedef typename ProtocolPolicy::template type<thrift_asio_framed_transport> framed_protocol_type;
+	// incoming frames and outgoing async calls are decoded/encoded from/to memory
+	typedef typename ProtocolPolicy::template type<apache::thrift::transport::TMemoryBuffer> memory_protocol_type;
+
+	// invoked with the client to read the reply with, or nullptr, if the call failed
+	typedef std::function<void(ClientType*)> reply_handler;
+
+	// fails the pending calls, before the event handlers of the client are invoked
+	class transport_events : public thrift_asio_client_transport::event_handlers
+	{
+	  public:
+		explicit transport_events(thrift_asio_client& client)
+			: client_(client)
+		{
+		}
+
+		virtual void on_error(const boost::system::error_code& ec) override
+		{
+			client_.fail_pending_calls();
+			handlers().on_error(ec);
+		}
+
+		virtual void on_connected() override
+		{
+			handlers().on_connected();
+		}
+
+		virtual void on_disconnected() override
+		{
+			client_.fail_pending_calls();
+			handlers().on_disconnected();
+		}
+
+		virtual void on_backpressure(const thrift_asio_transport::outbound_statistics& stats) override
+		{
+			handlers().on_backpressure(stats);
+		}
+
+	  private:
+		thrift_asio_client& client_;
+
+		// the client's own event handlers, which the generated interface can't shadow
+		thrift_asio_client_transport::event_handlers& handlers()
+		{
+			return client_;
+		}
+	};
+
 	boost::asio::io_service& io_service_;
 	ProcessorType processor_;
+	const compression_options compression_;
+	transport_events transport_events_; ///< the event handlers of transport_
 
 	boost::shared_ptr<thrift_asio_client_transport> transport_;
 	boost::shared_ptr<apache::thrift::protocol::TProtocol> input_protocol_;
@@ -111,22 +330,173 @@ class thrift_asio_client
 
 	std::shared_ptr<boost::asio::deadline_timer> reconnect_timer;
 
-	static boost::shared_ptr<apache::thrift::protocol::TProtocol>
-	make_input_protocol(boost::shared_ptr<thrift_asio_client_transport> transport)
+	boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> frame_buffer_; ///< observes the frame being dispatched
+	boost::shared_ptr<memory_protocol_type> frame_protocol_;
+	std::vector<uint8_t> frame_bytes_; ///< the storage of the frame being dispatched, reused by the next one
+
+	boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> call_buffer_; ///< the call being sent by async_call
+	boost::shared_ptr<memory_protocol_type> call_protocol_;
+
+	ClientType async_client_; ///< writes calls to call_buffer_ and reads replies from frame_buffer_
+	uint32_t next_seqid_;
+	std::unordered_map<int32_t, reply_handler> pending_calls_; ///< by sequence id
+
+	// serializes the call, stamps it with a sequence id and sends it.
+	// Returns false for oneway calls, that won't get a reply, so on_reply is never invoked.
+	template <typename Send>
+	bool send_call(Send& send, reply_handler on_reply)
 	{
-		boost::shared_ptr<apache::thrift::transport::TTransport> t2
-			= boost::make_shared<apache::thrift::transport::TFramedTransport>(transport);
-		if (use_compression)
-			t2 = boost::make_shared<apache::thrift::transport::TZlibTransport>(t2);
-		return boost::make_shared<apache::thrift::protocol::TBinaryProtocol>(t2);
+		using namespace apache::thrift::protocol;
+
+		call_buffer_->resetBuffer();
+		send(async_client_);
+
+		// the generated client always uses the sequence id 0, so the header is written again
+		std::string name;
+		TMessageType type;
+		int32_t seqid = 0;
+		call_protocol_->readMessageBegin(name, type, seqid);
+
+		seqid = int32_t(++next_seqid_ & 0x7fffffff);
+		if (type == T_CALL)
+			pending_calls_[seqid] = std::move(on_reply);
+
+		uint8_t* body = nullptr;
+		uint32_t body_size = 0;
+		call_buffer_->getBuffer(&body, &body_size);
+
+		output_protocol_->writeMessageBegin(name, type, seqid);
+		output_protocol_->getTransport()->write(body, body_size);
+		output_protocol_->getTransport()->writeEnd();
+		output_protocol_->getTransport()->flush();
+		return type == T_CALL;
+	}
+
+	template <typename Result, typename Receive>
+	static void fulfill(std::promise<Result>& promise, Receive& receive, ClientType* reply)
+	{
+		if (!reply)
+			return promise.set_exception(make_connection_lost());
+
+		try { promise.set_value(receive(*reply)); }
+		catch (...) { promise.set_exception(std::current_exception()); }
+	}
+
+	template <typename Receive>
+	static void fulfill(std::promise<void>& promise, Receive& receive, ClientType* reply)
+	{
+		if (!reply)
+			return promise.set_exception(make_connection_lost());
+
+		try { receive(*reply); promise.set_value(); }
+		catch (...) { promise.set_exception(std::current_exception()); }
+	}
+
+	// completes a oneway call, once it was sent
+	template <typename Result>
+	static void fulfill_oneway(std::promise<Result>& promise)
+	{
+		promise.set_exception(std::make_exception_ptr(apache::thrift::TApplicationException(
+			apache::thrift::TApplicationException::INVALID_MESSAGE_TYPE,
+			"a oneway call has no reply"
+		)));
+	}
+
+	static void fulfill_oneway(std::promise<void>& promise)
+	{
+		promise.set_value();
+	}
+
+	static std::exception_ptr make_connection_lost()
+	{
+		return std::make_exception_ptr(apache::thrift::transport::TTransportException(
+			apache::thrift::transport::TTransportException::NOT_OPEN,
+			"the connection was closed before the reply arrived"
+		));
 	}
 
-	static boost::shared_ptr<apache::thrift::protocol::TProtocol>
-	make_output_protocol(boost::shared_ptr<thrift_asio_client_transport> transport)
+	void fail_pending_calls()
 	{
-		boost::shared_ptr<apache::thrift::transport::TTransport> t2
-			= boost::make_shared<apache::thrift::transport::TFramedTransport>(transport);
-		return boost::make_shared<apache::thrift::protocol::TBinaryProtocol>(t2);
+		auto calls = std::move(pending_calls_);
+		pending_calls_.clear();
+		for (auto& call : calls)
+			call.second(nullptr);
+	}
+
+	// processes the next frame, which has been received completely.
+	// Replies complete their async_call, everything else goes to the processor.
+	void dispatch_frame()
+	{
+		using namespace apache::thrift::protocol;
+
+		auto framed = boost::static_pointer_cast<thrift_asio_framed_transport>(input_protocol_->getTransport());
+		uint32_t frame_size = framed->begin_frame();
+
+		// the frame is read out of the receive buffer, before it is dispatched. So a call of
+		// client_ or update() from within a handler reads the next frame, not this one again.
+		// A nested dispatch allocates its own frame, as this one might still be in use.
+		std::vector<uint8_t> frame_bytes;
+		frame_bytes.swap(frame_bytes_);
+		frame_bytes.resize(frame_size);
+		framed->readAll(frame_bytes.data(), frame_size);
+		auto frame_data = frame_bytes.data();
+
+		std::string name;
+		TMessageType type;
+		int32_t seqid = 0;
+		frame_buffer_->resetBuffer(frame_data, frame_size);
+		frame_protocol_->readMessageBegin(name, type, seqid);
+		frame_buffer_->resetBuffer(frame_data, frame_size);
+
+		if (type == T_REPLY || type == T_EXCEPTION)
+		{
+			auto call = pending_calls_.find(seqid);
+			if (call != pending_calls_.end())
+			{
+				auto on_reply = std::move(call->second);
+				pending_calls_.erase(call);
+				on_reply(&async_client_);
+			}
+			else
+			{
+				THRIFT_ASIO_LOG(log_level::warning, "thrift_asio_client: dropped reply to unknown call", {{"method", name}});
+			}
+		}
+		else
+		{
+			processor_.process(frame_protocol_, nullptr, nullptr);
+		}
+
+		frame_bytes_.swap(frame_bytes);
+	}
+
+	// true, if the next RPC call can be processed without waiting for more bytes
+	bool has_complete_frame()
+	{
+		if (!transport_->isOpen())
+			return false;
+
+		auto t = input_protocol_->getTransport();
+		return boost::static_pointer_cast<thrift_asio_framed_transport>(t)->has_complete_frame();
+	}
+
+	update_result make_update_result(size_t processed)
+	{
+		update_result result;
+		result.processed = processed;
+		result.pending_bytes = transport_->available_bytes();
+		result.backlog = has_complete_frame();
+		return result;
+	}
+
+	static boost::shared_ptr<apache::thrift::protocol::TProtocol> make_framed_protocol(
+		boost::shared_ptr<thrift_asio_client_transport> transport,
+		const compression_options& compression
+	)
+	{
+		return boost::make_shared<framed_protocol_type>(
+			boost::make_shared<thrift_asio_framed_transport>(transport, compression)
+		);
 	}
 
   protected:
@@ -25,8 +25,9 @@ class thrift_asio_client_transport : public thrift_asio_transport
 		boost::asio::io_service& io_service, ///< io_service to use
 		const std::string& host_name,        ///< name of the host to connect to
 		const std::string& service_name,     ///< i.e. port
-		event_handlers* event_handlers       ///< the event handlers to use
-	) : thrift_asio_transport(std::make_shared<boost::asio::ip::tcp::socket>(io_service), event_handlers)
+		event_handlers* event_handlers,      ///< the event handlers to use
+		const receive_buffer_options& options = receive_buffer_options() ///< receive chunk size
+	) : thrift_asio_transport(std::make_shared<boost::asio::ip::tcp::socket>(io_service), event_handlers, options)
 		, host_name_(host_name)
 		, service_name_(service_name)
 		, resolver_(io_service)
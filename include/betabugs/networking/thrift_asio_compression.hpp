@@ -0,0 +1,384 @@
+#ifndef _THRIFT_ASIO_COMPRESSION_HPP_
+#define _THRIFT_ASIO_COMPRESSION_HPP_
+
+#pragma once
+
+#include <thrift/transport/TTransportException.h>
+#include <zlib.h>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#ifdef THRIFT_ASIO_WITH_LZ4
+#	include <lz4.h>
+#endif
+
+#ifdef THRIFT_ASIO_WITH_ZSTD
+#	include <zstd.h>
+#endif
+
+namespace betabugs {
+namespace networking {
+
+/// the algorithms, that frames can be compressed with
+/*!
+* zlib is always available. Define THRIFT_ASIO_WITH_LZ4 and/or THRIFT_ASIO_WITH_ZSTD
+* (and link liblz4/libzstd) to enable the others.
+* */
+enum class compression_codec : uint8_t
+{
+	none = 0,
+	zlib = 1,
+	lz4  = 2,
+	zstd = 3
+};
+
+/*!
+* Controls, which frames a thrift_asio_framed_transport compresses and how.
+*
+* Frames smaller than min_size are sent uncompressed, as are frames, that
+* do not get smaller. Compressed frames are flagged, so the receiving end
+* decompresses them regardless of its own options.
+* */
+struct compression_options
+{
+	compression_options()
+		: codec(compression_codec::none)
+		, level(0)
+		, min_size(512)
+		, max_decompressed_size(16 * 1024 * 1024)
+	{
+	}
+
+	compression_codec codec;
+	/// 0 selects the default of the codec. zlib: 1..9, lz4: the acceleration (higher is faster),
+	/// zstd: the compression level (negative values are faster)
+	int level;
+	size_t min_size; ///< frames with fewer bytes are not compressed
+	/// received frames, that claim to decompress to more bytes, are rejected, unless a
+	/// smaller limit is passed to frame_codec::decompress_frame. 0 disables the limit.
+	uint32_t max_decompressed_size;
+	/// a dictionary trained with `zstd --train` on typical frames. zstd only, both ends need the same.
+	std::shared_ptr<const std::vector<uint8_t>> dictionary;
+};
+
+inline bool operator==(const compression_options& a, const compression_options& b)
+{
+	return a.codec == b.codec
+		&& a.level == b.level
+		&& a.min_size == b.min_size
+		&& a.max_decompressed_size == b.max_decompressed_size
+		&& a.dictionary == b.dictionary;
+}
+
+inline bool operator!=(const compression_options& a, const compression_options& b)
+{
+	return !(a == b);
+}
+
+/*!
+* Compresses and decompresses the frames of one connection.
+*
+* The contexts of the codecs are created on first use and reused for every frame.
+*
+* A compressed frame looks like this:
+*
+*   | frame size \| compressed_flag (4) | codec (1) | uncompressed size (4) | compressed bytes |
+*
+* where all integers are big endian. Uncompressed frames are plain thrift frames.
+* */
+class frame_codec
+{
+  public:
+	/// set in the size prefix of compressed frames
+	static constexpr uint32_t compressed_flag = 0x80000000u;
+	/// the codec and the uncompressed size, that precede the compressed bytes
+	static constexpr uint32_t compressed_header_size = 5;
+
+	explicit frame_codec(const compression_options& options = compression_options())
+		: options_(options)
+	{
+		if (!is_supported(options.codec))
+		{
+			throw apache::thrift::transport::TTransportException(
+				apache::thrift::transport::TTransportException::BAD_ARGS,
+				"compression codec is not compiled in"
+			);
+		}
+	}
+
+	frame_codec(const frame_codec&) = delete;
+	frame_codec& operator=(const frame_codec&) = delete;
+
+	~frame_codec()
+	{
+		if (deflate_) deflateEnd(deflate_.get());
+		if (inflate_) inflateEnd(inflate_.get());
+#ifdef THRIFT_ASIO_WITH_ZSTD
+		ZSTD_freeCCtx(zstd_cctx_);
+		ZSTD_freeDCtx(zstd_dctx_);
+		ZSTD_freeCDict(zstd_cdict_);
+		ZSTD_freeDDict(zstd_ddict_);
+#endif
+	}
+
+	const compression_options& options() const
+	{
+		return options_;
+	}
+
+	/// true, if this build can compress and decompress codec
+	static bool is_supported(compression_codec codec)
+	{
+		switch (codec)
+		{
+			case compression_codec::none:
+			case compression_codec::zlib:
+				return true;
+#ifdef THRIFT_ASIO_WITH_LZ4
+			case compression_codec::lz4:
+				return true;
+#endif
+#ifdef THRIFT_ASIO_WITH_ZSTD
+			case compression_codec::zstd:
+				return true;
+#endif
+			default:
+				return false;
+		}
+	}
+
+	/// true, if a payload of size bytes should be compressed
+	bool should_compress(size_t size) const
+	{
+		return options_.codec != compression_codec::none && size >= options_.min_size;
+	}
+
+	/// replaces the content of frame with the compressed frame of payload
+	/*!
+	* @returns false, if the compressed frame would not be smaller. frame is unspecified then.
+	* */
+	bool compress_frame(const uint8_t* payload, uint32_t size, std::vector<uint8_t>& frame)
+	{
+		const size_t header_size = sizeof(uint32_t) + compressed_header_size;
+		frame.resize(header_size + compress_bound(size));
+
+		size_t compressed_size = compress(payload, size, frame.data() + header_size, frame.size() - header_size);
+		if (compressed_size == 0 || compressed_size + compressed_header_size >= size)
+			return false;
+
+		frame.resize(header_size + compressed_size);
+		write_uint32(frame.data(), uint32_t(compressed_header_size + compressed_size) | compressed_flag);
+		frame[sizeof(uint32_t)] = uint8_t(options_.codec);
+		write_uint32(frame.data() + sizeof(uint32_t) + 1, size);
+		return true;
+	}
+
+	/// decompresses the payload of a frame, that had compressed_flag set, into out
+	/*!
+	* @param max_size frames, that decompress to more bytes, are rejected.
+	*                 If zero, compression_options::max_decompressed_size is used.
+	* @throws apache::thrift::transport::TTransportException, if the frame is corrupted
+	* */
+	void decompress_frame(const uint8_t* payload, uint32_t size, std::vector<uint8_t>& out, uint32_t max_size = 0)
+	{
+		using apache::thrift::transport::TTransportException;
+
+		if (size < compressed_header_size)
+			throw TTransportException(TTransportException::CORRUPTED_DATA, "compressed frame is too short");
+
+		auto codec = compression_codec(payload[0]);
+		uint32_t uncompressed_size = read_uint32(payload + 1);
+		if (max_size == 0)
+			max_size = options_.max_decompressed_size;
+		if (max_size != 0 && uncompressed_size > max_size)
+			throw TTransportException(TTransportException::CORRUPTED_DATA, "compressed frame is too big");
+		if (codec == compression_codec::none || !is_supported(codec))
+			throw TTransportException(TTransportException::CORRUPTED_DATA, "unknown compression codec");
+
+		out.resize(uncompressed_size);
+		if (!decompress(codec, payload + compressed_header_size, size - compressed_header_size, out.data(), uncompressed_size))
+			throw TTransportException(TTransportException::CORRUPTED_DATA, "corrupted compressed frame");
+	}
+
+  private:
+	const compression_options options_;
+
+	std::unique_ptr<z_stream> deflate_;
+	std::unique_ptr<z_stream> inflate_;
+#ifdef THRIFT_ASIO_WITH_ZSTD
+	ZSTD_CCtx* zstd_cctx_ = nullptr;
+	ZSTD_DCtx* zstd_dctx_ = nullptr;
+	ZSTD_CDict* zstd_cdict_ = nullptr;
+	ZSTD_DDict* zstd_ddict_ = nullptr;
+#endif
+
+	// big endian
+	static void write_uint32(uint8_t* dst, uint32_t value)
+	{
+		dst[0] = uint8_t(value >> 24);
+		dst[1] = uint8_t(value >> 16);
+		dst[2] = uint8_t(value >> 8);
+		dst[3] = uint8_t(value);
+	}
+
+	static uint32_t read_uint32(const uint8_t* src)
+	{
+		return uint32_t(src[0]) << 24 | uint32_t(src[1]) << 16 | uint32_t(src[2]) << 8 | uint32_t(src[3]);
+	}
+
+	size_t compress_bound(uint32_t size)
+	{
+		switch (options_.codec)
+		{
+#ifdef THRIFT_ASIO_WITH_LZ4
+			case compression_codec::lz4:
+				return size_t(LZ4_compressBound(int(size)));
+#endif
+#ifdef THRIFT_ASIO_WITH_ZSTD
+			case compression_codec::zstd:
+				return ZSTD_compressBound(size);
+#endif
+			default:
+				return compressBound(size);
+		}
+	}
+
+	// returns the compressed size or zero on failure
+	size_t compress(const uint8_t* src, uint32_t size, uint8_t* dst, size_t capacity)
+	{
+		switch (options_.codec)
+		{
+			case compression_codec::zlib:
+			{
+				if (!deflate_)
+				{
+					deflate_.reset(new z_stream());
+					int level = options_.level == 0 ? Z_DEFAULT_COMPRESSION : options_.level;
+					if (deflateInit(deflate_.get(), level) != Z_OK)
+					{
+						deflate_.reset();
+						return 0;
+					}
+				}
+				else
+				{
+					deflateReset(deflate_.get());
+				}
+
+				deflate_->next_in = const_cast<Bytef*>(src);
+				deflate_->avail_in = size;
+				deflate_->next_out = dst;
+				deflate_->avail_out = uInt(capacity);
+				if (deflate(deflate_.get(), Z_FINISH) != Z_STREAM_END)
+					return 0;
+				return capacity - deflate_->avail_out;
+			}
+#ifdef THRIFT_ASIO_WITH_LZ4
+			case compression_codec::lz4:
+			{
+				int acceleration = options_.level > 0 ? options_.level : 1;
+				int result = LZ4_compress_fast(
+					reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+					int(size), int(capacity), acceleration
+				);
+				return result > 0 ? size_t(result) : 0;
+			}
+#endif
+#ifdef THRIFT_ASIO_WITH_ZSTD
+			case compression_codec::zstd:
+			{
+				if (!zstd_cctx_)
+					zstd_cctx_ = ZSTD_createCCtx();
+
+				size_t result = 0;
+				if (options_.dictionary)
+				{
+					if (!zstd_cdict_)
+					{
+						zstd_cdict_ = ZSTD_createCDict(
+							options_.dictionary->data(), options_.dictionary->size(), options_.level
+						);
+					}
+					result = ZSTD_compress_usingCDict(zstd_cctx_, dst, capacity, src, size, zstd_cdict_);
+				}
+				else
+				{
+					result = ZSTD_compressCCtx(zstd_cctx_, dst, capacity, src, size, options_.level);
+				}
+				return ZSTD_isError(result) ? 0 : result;
+			}
+#endif
+			default:
+				return 0;
+		}
+	}
+
+	// returns false, if src did not decompress to exactly size bytes
+	bool decompress(compression_codec codec, const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t size)
+	{
+		switch (codec)
+		{
+			case compression_codec::zlib:
+			{
+				if (!inflate_)
+				{
+					inflate_.reset(new z_stream());
+					if (inflateInit(inflate_.get()) != Z_OK)
+					{
+						inflate_.reset();
+						return false;
+					}
+				}
+				else
+				{
+					inflateReset(inflate_.get());
+				}
+
+				inflate_->next_in = const_cast<Bytef*>(src);
+				inflate_->avail_in = src_size;
+				inflate_->next_out = dst;
+				inflate_->avail_out = size;
+				return inflate(inflate_.get(), Z_FINISH) == Z_STREAM_END && inflate_->avail_out == 0;
+			}
+#ifdef THRIFT_ASIO_WITH_LZ4
+			case compression_codec::lz4:
+			{
+				int result = LZ4_decompress_safe(
+					reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+					int(src_size), int(size)
+				);
+				return result >= 0 && uint32_t(result) == size;
+			}
+#endif
+#ifdef THRIFT_ASIO_WITH_ZSTD
+			case compression_codec::zstd:
+			{
+				if (!zstd_dctx_)
+					zstd_dctx_ = ZSTD_createDCtx();
+
+				size_t result = 0;
+				if (options_.dictionary)
+				{
+					if (!zstd_ddict_)
+						zstd_ddict_ = ZSTD_createDDict(options_.dictionary->data(), options_.dictionary->size());
+					result = ZSTD_decompress_usingDDict(zstd_dctx_, dst, size, src, src_size, zstd_ddict_);
+				}
+				else
+				{
+					result = ZSTD_decompressDCtx(zstd_dctx_, dst, size, src, src_size);
+				}
+				return !ZSTD_isError(result) && result == size;
+			}
+#endif
+			default:
+				return false;
+		}
+	}
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_COMPRESSION_HPP_
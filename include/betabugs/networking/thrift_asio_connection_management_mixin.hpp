@@ -5,6 +5,16 @@
 #ifndef _THRIFT_ASIO_THRIFT_ASIO_CONNECTION_MANAGEMENT_MIXIN_HPP_
 #define _THRIFT_ASIO_THRIFT_ASIO_CONNECTION_MANAGEMENT_MIXIN_HPP_
 
+#include <thrift/transport/TBufferTransports.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "./thrift_asio_framed_transport.hpp"
+#include "./thrift_asio_protocols.hpp"
+#include "./thrift_asio_transport.hpp"
+
 namespace betabugs{
 namespace networking{
 
@@ -18,6 +28,7 @@ namespace networking{
 * @tparam ClientType the client to create out of the output_protocol. If you want other session data,
 * you can wrap the auto-generted client into your own custom class that takes a
 * boost::shared_ptr<apache::thrift::protocol::TProtocol> as the first and only argument
+* @tparam ProtocolPolicy the protocol the server uses, see thrift_asio_protocols.hpp. broadcast() serializes with it.
 *
 * to respond to the current client:
 * @code
@@ -27,50 +38,101 @@ namespace networking{
 * to broadcast a message to all clients:
 *
 * @code
-* for(auto& client : clients_)
-* {
-* 	client.second->on_fancy_result_computed(42);
-* }
+* broadcast([](ClientType& client){ client.on_fancy_result_computed(42); });
 * @endcode
 *
+* broadcast() serializes the (oneway) call only once and queues the same frame on every
+* connection. Iterating clients_ and calling each of them works as well, but serializes
+* and copies the message once per client.
+*
+* If the io_service is run by multiple threads, lock clients_mutex_ while iterating clients_.
+* current_client_ is kept per thread and per handler, so it always refers to the client, whose
+* request the calling thread processes for this handler, even if a thread serves several.
+* Calls on clients other than current_client_ are not serialized with that client's own requests.
+*
+* Handlers, that override the callbacks, have to use the signatures with the connection_ptr.
+* on_client_connected returns it, on_client_disconnected and before_process take it as their
+* last argument. Overriding or calling the former signatures without it fails to compile,
+* instead of silently never being called.
 *
 * */
-template <typename ClientType>
+template <typename ClientType, typename ProtocolPolicy = binary_protocol>
 class thrift_asio_connection_management_mixin
 {
   public:
-	/// creates a ClientType objects and inserts it into clients_
-	virtual void on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	/// the registration of one connected client
+	/*!
+	* thrift_asio_server keeps the connection_ptr returned by on_client_connected
+	* for every connection and passes it to before_process, so finding the
+	* current client needs neither a lookup nor a lock.
+	* */
+	struct connection
 	{
-		assert( clients_.find(output_protocol) == clients_.end() );
+		std::shared_ptr<ClientType> client;
+		size_t slot; ///< the index into clients_. Changes, when other clients disconnect.
+	};
 
-		current_client_ = std::make_shared<ClientType>(output_protocol);
+	/// a handle to a connected client, that stays valid until it disconnects
+	typedef std::shared_ptr<connection> connection_ptr;
 
-		clients_.insert(
-			std::make_pair(
-				output_protocol,
-				current_client_
-			)
-		);
+	/// creates a ClientType objects and appends it to clients_
+	virtual connection_ptr on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		auto client = std::make_shared<ClientType>(output_protocol);
+		current_client_.set(client);
+
+		std::lock_guard<std::mutex> lock(clients_mutex_);
+		auto c = std::make_shared<connection>();
+		c->client = client;
+		c->slot = clients_.size();
+
+		clients_.push_back(std::make_pair(output_protocol, std::move(client)));
+		connections_.push_back(c);
+		return c;
 	}
 
-	/// erases the client associated with output_protocol from clients_
-	virtual void on_client_disconnected(const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol, const boost::system::error_code& ec)
+	/// removes the client of c from clients_ by moving the last client into its slot
+	virtual void on_client_disconnected(
+		const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol,
+		const boost::system::error_code& ec,
+		const connection_ptr& c
+	)
 	{
 		(void)ec;
-		assert( clients_.find(output_protocol) != clients_.end() );
-		clients_.erase(output_protocol);
-		assert( clients_.find(output_protocol) == clients_.end() );
+		(void)output_protocol;
+		std::lock_guard<std::mutex> lock(clients_mutex_);
+		assert(c->slot < clients_.size());
+		assert(clients_[c->slot].first == output_protocol);
+
+		if (c->slot != clients_.size() - 1)
+		{
+			clients_[c->slot] = std::move(clients_.back());
+			connections_[c->slot] = std::move(connections_.back());
+			connections_[c->slot]->slot = c->slot;
+		}
+		clients_.pop_back();
+		connections_.pop_back();
 	}
 
-	/// sets client associated with output_protocol as the current_client_
-	virtual void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	/// replaced by on_client_disconnected(output_protocol, ec, c)
+	virtual void on_client_disconnected(
+		const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol,
+		const boost::system::error_code& ec
+	) = delete;
+
+	/// sets the client of c as the current_client_
+	virtual void before_process(
+		const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol,
+		const connection_ptr& c
+	)
 	{
-		auto pos = clients_.find(output_protocol);
-		assert(pos != clients_.end());
-		current_client_ = pos->second;
+		(void)output_protocol;
+		current_client_.set(c->client);
 	}
 
+	/// replaced by before_process(output_protocol, c)
+	virtual void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol) = delete;
+
 	/// sets the current_client_ to zero
 	virtual void after_process()
 	{
@@ -85,14 +147,224 @@ class thrift_asio_connection_management_mixin
 	/// used as mapped_type in the client_map
 	typedef std::shared_ptr<ClientType> client_ptr;
 
-	/// maps protocol instances to clients
-	typedef std::map<protocol_ptr, client_ptr> client_map;
+	/// the client, whose request the calling thread processes for the handler, that owns this
+	/*!
+	* Behaves like a client_ptr. The clients are stored per thread, keyed by a token, that lives
+	* as long as the owner, so neither setting nor reading it needs a lock. A thread's entries of
+	* destroyed owners never match another owner, even one at the same address, and are dropped
+	* by the next set() on that thread.
+	* */
+	class current_client
+	{
+	  public:
+		current_client()
+			: token_(std::make_shared<char>())
+		{
+		}
+
+		current_client(const current_client&) = delete;
+		current_client& operator=(const current_client&) = delete;
+
+		~current_client()
+		{
+			reset();
+		}
+
+		client_ptr get() const
+		{
+			for (auto& entry : entries())
+			{
+				if (owns(entry))
+					return entry.second;
+			}
+			return client_ptr();
+		}
+
+		void set(client_ptr client)
+		{
+			if (!client)
+				return reset();
+
+			auto& e = entries();
+			for (size_t i = 0; i < e.size();)
+			{
+				if (owns(e[i]))
+				{
+					e[i].second = std::move(client);
+					return;
+				}
+
+				if (e[i].first.expired())
+				{
+					e[i] = std::move(e.back());
+					e.pop_back();
+				}
+				else
+					++i;
+			}
+			e.emplace_back(token_, std::move(client));
+		}
+
+		void reset()
+		{
+			auto& e = entries();
+			for (size_t i = 0; i < e.size(); ++i)
+			{
+				if (owns(e[i]))
+				{
+					e[i] = std::move(e.back());
+					e.pop_back();
+					return;
+				}
+			}
+		}
+
+		operator client_ptr() const
+		{
+			return get();
+		}
+
+		explicit operator bool() const
+		{
+			return bool(get());
+		}
+
+		ClientType* operator->() const
+		{
+			return get().get();
+		}
+
+		ClientType& operator*() const
+		{
+			return *get();
+		}
+
+	  private:
+		typedef std::pair<std::weak_ptr<char>, client_ptr> entry;
+
+		// identifies the entries of this. Its control block outlives every entry, that refers to it.
+		std::shared_ptr<char> token_;
+
+		bool owns(const entry& e) const
+		{
+			return !e.first.owner_before(token_) && !token_.owner_before(e.first);
+		}
+
+		// the current clients of the calling thread. Usually just one.
+		static std::vector<entry>& entries()
+		{
+			static thread_local std::vector<entry> e;
+			return e;
+		}
+	};
+
+	/// the connected clients and their protocol instances, in no particular order
+	typedef std::vector<std::pair<protocol_ptr, client_ptr>> client_map;
+
+	/// sends a oneway call to all clients but except, serializing it only once
+	/*!
+	* call is invoked once with a ClientType, that writes into a buffer, i.e.
+	* @code
+	* broadcast([&](ClientType& c){ c.on_message(user_name, message); }, current_client_);
+	* @endcode
+	* The resulting frame is queued on the transports of all connected clients without copying it.
+	* It is compressed once per distinct compression_options of the clients (thrift_asio_server
+	* uses the same options for all of its connections), with codecs, that are kept for the
+	* next broadcast. Clients, whose output_protocol does not write to a thrift_asio_framed_transport,
+	* are called one by one instead.
+	*
+	* clients_mutex_ is only held while the clients are collected, not while the frame is written,
+	* so it must not be held by the caller, but connections may come and go meanwhile.
+	* */
+	template <typename Function>
+	void broadcast(Function call, const client_ptr& except = client_ptr())
+	{
+		using apache::thrift::transport::TMemoryBuffer;
+
+		client_map clients;
+		{
+			std::lock_guard<std::mutex> lock(clients_mutex_);
+			clients.reserve(clients_.size());
+			for (auto& client : clients_)
+			{
+				if (client.second != except)
+					clients.push_back(client);
+			}
+		}
+
+		boost::shared_ptr<TMemoryBuffer> payload;
+		std::vector<std::pair<const compression_options*, thrift_asio_transport::shared_buffer>> frames;
+
+		for (auto& client : clients)
+		{
+			auto framed = boost::dynamic_pointer_cast<thrift_asio_framed_transport>(client.first->getTransport());
+			auto transport = framed ? framed->getUnderlyingTransport() : boost::shared_ptr<thrift_asio_transport>();
+
+			if (!transport)
+			{
+				call(*client.second);
+				continue;
+			}
+
+			if (!payload)
+			{
+				payload = boost::make_shared<TMemoryBuffer>();
+				ClientType serializer(boost::make_shared<typename ProtocolPolicy::template type<TMemoryBuffer>>(payload));
+				call(serializer);
+			}
+
+			const auto& compression = framed->compression();
+			auto frame = std::find_if(frames.begin(), frames.end(),
+				[&compression](const std::pair<const compression_options*, thrift_asio_transport::shared_buffer>& f)
+				{
+					return *f.first == compression;
+				}
+			);
+			if (frame == frames.end())
+			{
+				uint8_t* data = nullptr;
+				uint32_t size = 0;
+				payload->getBuffer(&data, &size);
+				frames.emplace_back(&compression, make_broadcast_frame(data, size, compression));
+				frame = frames.end() - 1;
+			}
+
+			transport->write(frame->second);
+		}
+	}
 
 	/// All connected clients.
 	client_map clients_;
 
-	/// Only valid while a request is processed.
-	client_ptr current_client_;
+	/// The connection of clients_[i] is connections_[i].
+	std::vector<connection_ptr> connections_;
+
+	/// Guards clients_ and connections_.
+	std::mutex clients_mutex_;
+
+	/// Only valid while a request is processed. One per thread.
+	current_client current_client_;
+
+  private:
+	/// the codecs of broadcast(), one per compression_options
+	std::vector<std::unique_ptr<frame_codec>> broadcast_codecs_;
+
+	/// Guards broadcast_codecs_ and their use.
+	std::mutex broadcast_codecs_mutex_;
+
+	thrift_asio_transport::shared_buffer make_broadcast_frame(const uint8_t* payload, uint32_t size, const compression_options& compression)
+	{
+		std::lock_guard<std::mutex> lock(broadcast_codecs_mutex_);
+		auto codec = std::find_if(broadcast_codecs_.begin(), broadcast_codecs_.end(),
+			[&compression](const std::unique_ptr<frame_codec>& c){ return c->options() == compression; }
+		);
+		if (codec == broadcast_codecs_.end())
+		{
+			broadcast_codecs_.emplace_back(new frame_codec(compression));
+			codec = broadcast_codecs_.end() - 1;
+		}
+		return thrift_asio_framed_transport::make_frame(payload, size, **codec);
+	}
 };
 
 }
@@ -0,0 +1,161 @@
+#ifndef _THRIFT_ASIO_COROUTINE_HPP_
+#define _THRIFT_ASIO_COROUTINE_HPP_
+
+#pragma once
+
+/*!
+* \file
+* C++20 coroutine support. Everything in here is only available, if the compiler supports
+* coroutines, in which case THRIFT_ASIO_HAS_COROUTINES is defined.
+*
+* Coroutines are resumed by whatever completes the operation they await, so no extra
+* threads are involved:
+*  - thrift_asio_client::co_call resumes the coroutine from within thrift_asio_client::update()
+*  - resume_on(worker_pool&) resumes it on a worker thread
+*
+* A client, that chains calls without a state machine:
+* @code
+* betabugs::networking::detached_task add_twice(my_client& client)
+* {
+*   int32_t sum = co_await client.co_call(
+*     [](MyServerClient& c){ c.send_add(20, 22); },
+*     [](MyServerClient& c){ return c.recv_add(); }
+*   );
+*   sum = co_await client.co_call(
+*     [sum](MyServerClient& c){ c.send_add(sum, sum); },
+*     [](MyServerClient& c){ return c.recv_add(); }
+*   );
+* }
+* @endcode
+*
+* A server handler (see thrift_asio_server, asynchronous handlers), that suspends while computing:
+* @code
+* void add(tcxx::function<void(int32_t const& _return)> cob, const int32_t a, const int32_t b) override
+* {
+*   [](auto cob, int32_t a, int32_t b, worker_pool& workers) -> betabugs::networking::detached_task
+*   {
+*     co_await betabugs::networking::resume_on(workers);
+*     cob(expensive_add(a, b)); // the reply is sent on the strand of the connection
+*   }(cob, a, b, workers_);
+* }
+* @endcode
+* */
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#	define THRIFT_ASIO_HAS_COROUTINES 1
+#endif
+
+#ifdef THRIFT_ASIO_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <utility>
+#include "./thrift_asio_log.hpp"
+#include "./worker_pool.hpp"
+
+namespace betabugs {
+namespace networking {
+
+/// the return type of a coroutine, that runs on its own, until it finishes
+/*!
+* The coroutine starts right away and its frame is destroyed, when it finishes.
+* Exceptions, that leave it, are logged (see thrift_asio_log.hpp).
+* */
+struct detached_task
+{
+	struct promise_type
+	{
+		detached_task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+
+		void unhandled_exception() noexcept
+		{
+			try { throw; }
+			catch (const std::exception& e) { THRIFT_ASIO_LOG(log_level::error, "detached_task failed", {{"error", e.what()}}); }
+			catch (...) { THRIFT_ASIO_LOG(log_level::error, "detached_task failed", {{"error", "unknown exception"}}); }
+		}
+	};
+};
+
+/// awaits a call of thrift_asio_client::async_call. Returned by thrift_asio_client::co_call.
+template <typename Client, typename Send, typename Receive>
+class call_awaiter
+{
+  public:
+	typedef typename Client::template reply_type<Receive> result_type;
+
+	call_awaiter(Client& client, Send send, Receive receive)
+		: client_(client)
+		, send_(std::move(send))
+		, receive_(std::move(receive))
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> coroutine)
+	{
+		client_.async_call(std::move(send_), std::move(receive_), [this, coroutine](std::future<result_type> result)
+		{
+			result_ = std::move(result);
+			coroutine.resume();
+		});
+	}
+
+	/// the result of the call. Throws, what the call threw.
+	result_type await_resume()
+	{
+		return result_.get();
+	}
+
+  private:
+	Client& client_;
+	Send send_;
+	Receive receive_;
+	std::future<result_type> result_;
+};
+
+/// awaitable, that continues the coroutine on a thread of workers
+/*!
+* @code
+* co_await resume_on(workers);
+* @endcode
+* */
+class resume_on
+{
+  public:
+	explicit resume_on(worker_pool& workers)
+		: workers_(workers)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> coroutine)
+	{
+		workers_.post([coroutine]{ coroutine.resume(); });
+	}
+
+	void await_resume() const noexcept
+	{
+	}
+
+  private:
+	worker_pool& workers_;
+};
+
+}
+}
+
+#endif // THRIFT_ASIO_HAS_COROUTINES
+
+#endif //_THRIFT_ASIO_COROUTINE_HPP_
@@ -0,0 +1,299 @@
+#ifndef _THRIFT_ASIO_FRAMED_TRANSPORT_HPP_
+#define _THRIFT_ASIO_FRAMED_TRANSPORT_HPP_
+
+#pragma once
+
+#include <thrift/transport/TVirtualTransport.h>
+#include <thrift/transport/TTransportException.h>
+#include <algorithm>
+#include <cstring>
+#include "./thrift_asio_compression.hpp"
+#include "./thrift_asio_transport.hpp"
+
+namespace betabugs {
+namespace networking {
+
+/*!
+* Frames messages like apache::thrift::transport::TFramedTransport, but on top of a
+* thrift_asio_transport, whose concrete type is known.
+*
+* Protocols instantiated on it (i.e. TBinaryProtocolT<thrift_asio_framed_transport>) call
+* read/write/borrow/consume without virtual dispatch, all the way down to the receive
+* ring buffer and the send buffer. Outgoing frames are built in a pooled buffer of the
+* thrift_asio_transport and handed over without copying them again. Incoming frames are
+* read straight from the receive buffer instead of being copied into a frame buffer first.
+*
+* Frames are compressed according to compression_options (see thrift_asio_compression.hpp).
+* Compressed frames are flagged, so they are decompressed when read, regardless of the options.
+*
+* Like TFramedTransport, an instance must not be written to from multiple threads at once.
+* */
+class thrift_asio_framed_transport
+	: public apache::thrift::transport::TVirtualTransport<thrift_asio_framed_transport>
+{
+  public:
+	/// frames messages sent and received by transport
+	explicit thrift_asio_framed_transport(
+		boost::shared_ptr<thrift_asio_transport> transport,
+		const compression_options& compression = compression_options()
+	)
+		: transport_(transport)
+		, codec_(compression)
+		, frame_size_(0)
+		, read_remaining_(0)
+		, is_decompressed_(false)
+	{
+		assert(transport_);
+	}
+
+	/// the options, outgoing frames are compressed with
+	const compression_options& compression() const
+	{
+		return codec_.options();
+	}
+
+	/// builds a frame out of payload, that any thrift_asio_framed_transport can read
+	/*!
+	* The payload is compressed with codec, if it's worth it.
+	* */
+	static thrift_asio_transport::shared_buffer make_frame(const uint8_t* payload, uint32_t size, frame_codec& codec)
+	{
+		auto frame = std::make_shared<std::vector<uint8_t>>();
+		if (codec.should_compress(size) && codec.compress_frame(payload, size, *frame))
+			return thrift_asio_transport::shared_buffer(std::move(frame));
+
+		frame->resize(sizeof(uint32_t));
+		write_frame_size(frame->data(), size);
+		frame->insert(frame->end(), payload, payload + size);
+		return thrift_asio_transport::shared_buffer(std::move(frame));
+	}
+
+	/// the transport, that the frames are sent with
+	boost::shared_ptr<thrift_asio_transport> getUnderlyingTransport()
+	{
+		return transport_;
+	}
+
+	virtual bool isOpen() override
+	{
+		return transport_->isOpen();
+	}
+
+	/// true, if the current frame has unread bytes or new bytes were received
+	virtual bool peek() override
+	{
+		return read_remaining_ > 0 || transport_->peek();
+	}
+
+	virtual void open() override
+	{
+		transport_->open();
+	}
+
+	virtual void close() override
+	{
+		transport_->close();
+	}
+
+	virtual const std::string getOrigin() override
+	{
+		return transport_->getOrigin();
+	}
+
+	/// true, if the next frame has been received completely, so that reading it does not block
+	/*!
+	* Only looks at the frame size prefix and the number of received bytes, so it is
+	* cheap enough to be called before every message. Empty frames are skipped.
+	* Returns true while a frame is being read, as its bytes are already available.
+	* */
+	bool has_complete_frame()
+	{
+		if (read_remaining_ > 0)
+			return true;
+
+		for (;;)
+		{
+			uint32_t frame_size = 0;
+			if (transport_->peek_bytes(reinterpret_cast<uint8_t*>(&frame_size), sizeof(frame_size)) < sizeof(frame_size))
+				return false;
+
+			frame_size = ntohl(frame_size) & ~frame_codec::compressed_flag;
+			if (frame_size != 0)
+				return transport_->available_bytes() - sizeof(frame_size) >= frame_size;
+
+			transport_->consume(sizeof(frame_size));
+		}
+	}
+
+	/// starts reading the next frame, if none is being read, and returns its unread size
+	/*!
+	* Compressed frames are decompressed here and the decompressed size is returned.
+	* Blocks like read(), unless has_complete_frame() returned true before.
+	* */
+	uint32_t begin_frame()
+	{
+		if (read_remaining_ == 0)
+			read_frame_header();
+		return read_remaining_;
+	}
+
+	/// reads up to len bytes of the current frame. Blocks for the next frame, if there is none.
+	uint32_t read(uint8_t* buf, uint32_t len)
+	{
+		if (read_remaining_ == 0)
+			read_frame_header();
+
+		len = std::min(len, read_remaining_);
+		if (is_decompressed_)
+			std::memcpy(buf, decompressed_data(), len);
+		else
+			len = transport_->read(buf, len);
+		read_remaining_ -= len;
+		return len;
+	}
+
+	/// returns a pointer to len bytes of the current frame without copying them
+	/*!
+	* Returns nullptr, if the current frame has less than len bytes left or they
+	* are not stored contiguously. The caller is expected to fall back to read() then.
+	* */
+	const uint8_t* borrow(uint8_t* buf, uint32_t* len)
+	{
+		if (read_remaining_ < *len)
+			return nullptr;
+
+		if (is_decompressed_)
+		{
+			*len = read_remaining_;
+			return decompressed_data();
+		}
+
+		auto data = transport_->borrow(buf, len);
+		if (data)
+			*len = std::min(*len, read_remaining_);
+		return data;
+	}
+
+	/// removes len bytes of the current frame, after they were borrow()ed
+	void consume(uint32_t len)
+	{
+		if (len > read_remaining_)
+		{
+			throw apache::thrift::transport::TTransportException(
+				apache::thrift::transport::TTransportException::BAD_ARGS,
+				"consume did not follow a borrow."
+			);
+		}
+		if (!is_decompressed_)
+			transport_->consume(len);
+		read_remaining_ -= len;
+	}
+
+	/// skips whatever is left of the current frame
+	virtual uint32_t readEnd() override
+	{
+		uint8_t scratch[256];
+		while (read_remaining_ > 0)
+			read(scratch, std::min<uint32_t>(sizeof(scratch), read_remaining_));
+		return frame_size_;
+	}
+
+	/// appends len bytes to the frame, that is sent by the next flush()
+	void write(const uint8_t* buf, uint32_t len)
+	{
+		if (!write_buffer_)
+		{
+			write_buffer_ = transport_->acquire_buffer();
+			write_buffer_->resize(sizeof(uint32_t)); // room for the frame size
+		}
+		write_buffer_->insert(write_buffer_->end(), buf, buf + len);
+	}
+
+	/// the number of bytes written to the current frame
+	virtual uint32_t writeEnd() override
+	{
+		return write_buffer_ ? uint32_t(write_buffer_->size() - sizeof(uint32_t)) : 0;
+	}
+
+	/// prefixes the written bytes with their size and sends them as one frame
+	virtual void flush() override
+	{
+		if (!write_buffer_)
+			return;
+
+		auto payload_size = uint32_t(write_buffer_->size() - sizeof(uint32_t));
+		if (codec_.should_compress(payload_size))
+		{
+			auto frame = transport_->acquire_buffer();
+			if (codec_.compress_frame(write_buffer_->data() + sizeof(uint32_t), payload_size, *frame))
+			{
+				transport_->write(thrift_asio_transport::shared_buffer(std::move(frame)));
+				write_buffer_->resize(sizeof(uint32_t)); // reused for the next frame
+				return;
+			}
+		}
+
+		write_frame_size(write_buffer_->data(), payload_size);
+		transport_->write(thrift_asio_transport::shared_buffer(std::move(write_buffer_)));
+		write_buffer_.reset();
+	}
+
+  private:
+	boost::shared_ptr<thrift_asio_transport> transport_;
+	std::shared_ptr<std::vector<uint8_t>> write_buffer_; ///< the frame being written, if any
+	frame_codec codec_;
+	uint32_t frame_size_;     ///< size of the frame being read (after decompression)
+	uint32_t read_remaining_; ///< bytes of that frame, that were not read yet
+	bool is_decompressed_;    ///< true, if the frame is read from decompressed_ instead of transport_
+	std::vector<uint8_t> compressed_;
+	std::vector<uint8_t> decompressed_;
+
+	static void write_frame_size(uint8_t* dst, uint32_t frame_size)
+	{
+		frame_size = htonl(frame_size);
+		std::memcpy(dst, &frame_size, sizeof(frame_size));
+	}
+
+	const uint8_t* decompressed_data() const
+	{
+		return decompressed_.data() + (frame_size_ - read_remaining_);
+	}
+
+	// reads the size of the next non-empty frame and decompresses it, if necessary
+	void read_frame_header()
+	{
+		do
+		{
+			uint32_t frame_size = 0;
+			transport_->read(reinterpret_cast<uint8_t*>(&frame_size), sizeof(frame_size));
+			frame_size_ = ntohl(frame_size);
+			is_decompressed_ = (frame_size_ & frame_codec::compressed_flag) != 0;
+
+			if (is_decompressed_)
+			{
+				// compressed frames are smaller than their payload, so they are bound by the same limit
+				auto max_size = codec_.options().max_decompressed_size;
+				auto compressed_size = frame_size_ & ~frame_codec::compressed_flag;
+				if (max_size != 0 && compressed_size > max_size)
+				{
+					throw apache::thrift::transport::TTransportException(
+						apache::thrift::transport::TTransportException::CORRUPTED_DATA,
+						"compressed frame is too big"
+					);
+				}
+
+				compressed_.resize(compressed_size);
+				transport_->readAll(compressed_.data(), compressed_size);
+				codec_.decompress_frame(compressed_.data(), compressed_size, decompressed_, max_size);
+				frame_size_ = uint32_t(decompressed_.size());
+			}
+		} while (frame_size_ == 0);
+
+		read_remaining_ = frame_size_;
+	}
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_FRAMED_TRANSPORT_HPP_
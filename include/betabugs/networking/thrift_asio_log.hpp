@@ -0,0 +1,460 @@
+#ifndef _THRIFT_ASIO_LOG_HPP_
+#define _THRIFT_ASIO_LOG_HPP_
+
+#pragma once
+
+#include <boost/system/error_code.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+namespace betabugs {
+namespace networking {
+
+/// false, if THRIFT_ASIO_NO_LOGGING is defined. Nothing is logged then.
+#ifdef THRIFT_ASIO_NO_LOGGING
+constexpr bool logging_enabled = false;
+#else
+constexpr bool logging_enabled = true;
+#endif
+
+enum class log_level
+{
+	debug,
+	info,
+	warning,
+	error,
+	none ///< only used as a level of a logger, to log nothing
+};
+
+inline const char* to_string(log_level level)
+{
+	switch (level)
+	{
+		case log_level::debug: return "debug";
+		case log_level::info: return "info";
+		case log_level::warning: return "warning";
+		case log_level::error: return "error";
+		case log_level::none: break;
+	}
+	return "none";
+}
+
+/// a key and a value, that are logged along with a message
+/*!
+* The value is copied, so that the record can be written later by another thread.
+* Text is truncated to max_text_size bytes. error_codes are stored as their value
+* and category, their message is only looked up, when the record is written.
+* */
+struct log_field
+{
+	static constexpr size_t max_text_size = 47;
+
+	enum class kind { number, text, error_code };
+
+	log_field()
+		: key("")
+		, type(kind::number)
+		, number(0)
+		, category(nullptr)
+	{
+		text[0] = '\0';
+	}
+
+	template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+	log_field(const char* key, T value)
+		: key(key)
+		, type(kind::number)
+		, number(int64_t(value))
+		, category(nullptr)
+	{
+		text[0] = '\0';
+	}
+
+	log_field(const char* key, const char* value)
+		: key(key)
+		, type(kind::text)
+		, number(0)
+		, category(nullptr)
+	{
+		copy_text(value, std::strlen(value));
+	}
+
+	log_field(const char* key, const std::string& value)
+		: key(key)
+		, type(kind::text)
+		, number(0)
+		, category(nullptr)
+	{
+		copy_text(value.data(), value.size());
+	}
+
+	log_field(const char* key, const boost::system::error_code& ec)
+		: key(key)
+		, type(kind::error_code)
+		, number(ec.value())
+		, category(&ec.category())
+	{
+		text[0] = '\0';
+	}
+
+	const char* key; ///< must be a string literal
+	kind type;
+	int64_t number; ///< the number or the value of the error_code
+	const boost::system::error_category* category;
+	char text[max_text_size + 1];
+
+	void write_to(std::ostream& out) const
+	{
+		out << key << '=';
+		switch (type)
+		{
+			case kind::number: out << number; break;
+			case kind::text: out << '"' << text << '"'; break;
+			case kind::error_code: out << '"' << category->message(int(number)) << '"'; break;
+		}
+	}
+
+  private:
+	void copy_text(const char* value, size_t size)
+	{
+		size = std::min(size, size_t(max_text_size));
+		std::memcpy(text, value, size);
+		text[size] = '\0';
+	}
+};
+
+/// one message, as it is passed to a logger
+struct log_record
+{
+	static constexpr size_t max_fields = 4;
+
+	log_record()
+		: level(log_level::info)
+		, message("")
+		, num_fields(0)
+	{
+	}
+
+	/// fields beyond max_fields are ignored
+	log_record(log_level level, const char* message, std::initializer_list<log_field> fields)
+		: level(level)
+		, time(std::chrono::system_clock::now())
+		, message(message)
+		, num_fields(std::min(fields.size(), size_t(max_fields)))
+	{
+		std::copy(fields.begin(), fields.begin() + num_fields, this->fields.begin());
+	}
+
+	log_level level;
+	std::chrono::system_clock::time_point time;
+	const char* message; ///< must be a string literal
+	size_t num_fields;
+	std::array<log_field, max_fields> fields;
+
+	/// writes the record as one line, i.e. "2026-10-16T12:00:00.123Z warning message key=value"
+	void write_to(std::ostream& out) const
+	{
+		auto since_epoch = time.time_since_epoch();
+		auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+		auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch - seconds);
+
+		std::time_t t = std::time_t(seconds.count());
+		std::tm tm;
+		gmtime_r(&t, &tm);
+
+		char timestamp[32];
+		auto n = std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &tm);
+		std::snprintf(timestamp + n, sizeof(timestamp) - n, ".%03dZ", int(milliseconds.count()));
+
+		out << timestamp << ' ' << to_string(level) << ' ' << message;
+		for (size_t i = 0; i < num_fields; ++i)
+		{
+			out << ' ';
+			fields[i].write_to(out);
+		}
+		out << '\n';
+	}
+};
+
+/// receives the messages of thrift_asio. Install one with set_logger.
+/*!
+* log is called on the io_service threads (or the threads of a worker_pool), so it
+* must be thread safe, and it should not block.
+* */
+class logger
+{
+  public:
+	logger()
+		: level_(log_level::info)
+	{
+	}
+
+	virtual ~logger() {}
+
+	virtual void log(const log_record& record) = 0;
+
+	/// messages below this level are not passed to log
+	log_level level() const
+	{
+		return level_.load(std::memory_order_relaxed);
+	}
+
+	void set_level(log_level level)
+	{
+		level_.store(level, std::memory_order_relaxed);
+	}
+
+  private:
+	std::atomic<log_level> level_;
+};
+
+/*!
+* The default logger: log() copies the record into a lock-free ring buffer, a background
+* thread writes them to a std::ostream. So logging never waits for the stream.
+*
+* If the ring buffer is full, the record is dropped. The number of dropped records is
+* written, once there is room again. The background thread is started with the first record.
+* */
+class async_logger : public logger
+{
+  public:
+	/// @param capacity the number of records, that the ring buffer holds. Rounded up to a power of two.
+	explicit async_logger(std::ostream& out = std::clog, size_t capacity = 1024)
+		: out_(out)
+		, capacity_(round_up_to_power_of_two(capacity))
+		, slots_(new slot[capacity_])
+		, enqueue_position_(0)
+		, dequeue_position_(0)
+		, num_dropped_(0)
+		, stop_(false)
+	{
+		for (size_t i = 0; i < capacity_; ++i)
+			slots_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	async_logger(const async_logger&) = delete;
+	async_logger& operator=(const async_logger&) = delete;
+
+	/// writes the remaining records
+	~async_logger()
+	{
+		{
+			std::lock_guard<std::mutex> lock(drain_mutex_);
+			stop_ = true;
+		}
+		wake_.notify_one();
+		if (thread_.joinable())
+			thread_.join();
+		flush();
+	}
+
+	virtual void log(const log_record& record) override
+	{
+		std::call_once(thread_started_, [this]{ thread_ = std::thread([this]{ run(); }); });
+
+		// a bounded multi-producer queue, as described by Dmitry Vyukov
+		size_t position = enqueue_position_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			auto& s = slots_[position & (capacity_ - 1)];
+			size_t sequence = s.sequence.load(std::memory_order_acquire);
+			auto difference = intptr_t(sequence) - intptr_t(position);
+			if (difference == 0)
+			{
+				if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					s.record = record;
+					s.sequence.store(position + 1, std::memory_order_release);
+					return;
+				}
+			}
+			else if (difference < 0)
+			{
+				num_dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+			{
+				position = enqueue_position_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/// writes the records, that were logged so far, from the calling thread
+	void flush()
+	{
+		std::lock_guard<std::mutex> lock(drain_mutex_);
+		drain();
+	}
+
+	/// the number of records, that were dropped, because the ring buffer was full
+	uint64_t num_dropped() const
+	{
+		return num_dropped_.load(std::memory_order_relaxed);
+	}
+
+  private:
+	struct slot
+	{
+		std::atomic<size_t> sequence;
+		log_record record;
+	};
+
+	std::ostream& out_;
+	const size_t capacity_;
+	std::unique_ptr<slot[]> slots_;
+	std::atomic<size_t> enqueue_position_;
+	size_t dequeue_position_; ///< guarded by drain_mutex_
+	std::atomic<uint64_t> num_dropped_;
+	uint64_t num_reported_dropped_ = 0; ///< guarded by drain_mutex_
+
+	std::mutex drain_mutex_; ///< only taken by the thread, that writes the records
+	std::condition_variable wake_;
+	bool stop_; ///< guarded by drain_mutex_
+	std::once_flag thread_started_;
+	std::thread thread_;
+
+	void run()
+	{
+		// producers don't notify, so the thread polls
+		const std::chrono::milliseconds poll_interval(10);
+
+		std::unique_lock<std::mutex> lock(drain_mutex_);
+		while (!stop_)
+		{
+			drain();
+			wake_.wait_for(lock, poll_interval);
+		}
+	}
+
+	// drain_mutex_ must be locked
+	void drain()
+	{
+		bool wrote = false;
+		for (;;)
+		{
+			auto& s = slots_[dequeue_position_ & (capacity_ - 1)];
+			if (s.sequence.load(std::memory_order_acquire) != dequeue_position_ + 1)
+				break;
+
+			s.record.write_to(out_);
+			s.sequence.store(dequeue_position_ + capacity_, std::memory_order_release);
+			++dequeue_position_;
+			wrote = true;
+		}
+
+		auto num_dropped = num_dropped_.load(std::memory_order_relaxed);
+		if (num_dropped != num_reported_dropped_)
+		{
+			out_ << "thrift_asio: dropped " << (num_dropped - num_reported_dropped_) << " log messages\n";
+			num_reported_dropped_ = num_dropped;
+			wrote = true;
+		}
+
+		if (wrote)
+			out_.flush();
+	}
+
+	static size_t round_up_to_power_of_two(size_t n)
+	{
+		size_t result = 1;
+		while (result < n)
+			result *= 2;
+		return result;
+	}
+};
+
+/// the logger, that is used, if none was set with set_logger
+/*!
+* It is never destroyed, so that the destructors of other statics can still log at exit.
+* The records, that were logged until the exit handlers run, are flushed by one of them.
+* */
+inline async_logger& default_logger()
+{
+	static async_logger* instance = []
+	{
+		auto l = new async_logger;
+		std::atexit([]{ default_logger().flush(); });
+		return l;
+	}();
+	return *instance;
+}
+
+namespace detail {
+inline std::atomic<logger*>& installed_logger()
+{
+	static std::atomic<logger*> instance(nullptr);
+	return instance;
+}
+}
+
+/// the logger, that receives the messages of thrift_asio
+inline logger& current_logger()
+{
+	auto installed = detail::installed_logger().load(std::memory_order_acquire);
+	return installed ? *installed : default_logger();
+}
+
+/// makes l receive the messages of thrift_asio. nullptr restores default_logger().
+/*!
+* l has to outlive everything, that might log, i.e. the io_services.
+* To log nothing, call current_logger().set_level(log_level::none).
+* */
+inline void set_logger(logger* l)
+{
+	detail::installed_logger().store(l, std::memory_order_release);
+}
+
+/// true, if a message of level would be passed to current_logger()
+inline bool is_logged(log_level level)
+{
+	return logging_enabled && level >= current_logger().level();
+}
+
+/// passes a message to current_logger(), if its level is high enough
+/*!
+* @code
+* log_message(log_level::warning, "frame exceeds max_frame_size", {{"frame_size", frame_size}});
+* @endcode
+* The fields are built before the level is checked. Use THRIFT_ASIO_LOG, where that matters.
+* */
+inline void log_message(log_level level, const char* message, std::initializer_list<log_field> fields = {})
+{
+	if (!is_logged(level))
+		return;
+
+	current_logger().log(log_record(level, message, fields));
+}
+
+}
+}
+
+/// like log_message, but the fields are only built, if the level is logged
+/*!
+* @code
+* THRIFT_ASIO_LOG(log_level::info, "client disconnected", {{"error", ec}});
+* @endcode
+* */
+#define THRIFT_ASIO_LOG(level, ...) \
+	do \
+	{ \
+		if (::betabugs::networking::is_logged(level)) \
+			::betabugs::networking::log_message(level, __VA_ARGS__); \
+	} while (false)
+
+#endif //_THRIFT_ASIO_LOG_HPP_
@@ -0,0 +1,439 @@
+#ifndef _THRIFT_ASIO_METRICS_HPP_
+#define _THRIFT_ASIO_METRICS_HPP_
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace betabugs {
+namespace networking {
+
+/// false, if THRIFT_ASIO_NO_METRICS is defined. Metrics are not collected then, even if a registry is set.
+#ifdef THRIFT_ASIO_NO_METRICS
+constexpr bool metrics_enabled = false;
+#else
+constexpr bool metrics_enabled = true;
+#endif
+
+/// a histogram of durations with fixed buckets, that can be recorded into from any thread
+class latency_histogram
+{
+  public:
+	/// the number of buckets with an upper bound. One more bucket counts everything above.
+	static constexpr size_t num_bounds = 20;
+
+	/// the upper bounds of the buckets in microseconds
+	static const std::array<uint64_t, num_bounds>& bounds_us()
+	{
+		static const std::array<uint64_t, num_bounds> bounds = {{
+			5, 10, 25, 50, 100, 250, 500,
+			1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+			1000000, 2500000, 5000000, 10000000
+		}};
+		return bounds;
+	}
+
+	/// the counts of a latency_histogram at one point in time
+	struct statistics
+	{
+		std::array<uint64_t, num_bounds + 1> counts = {{}}; ///< per bucket, not cumulative
+		uint64_t count = 0;
+		uint64_t sum_ns = 0;
+	};
+
+	latency_histogram()
+		: count_(0)
+		, sum_ns_(0)
+	{
+		for (auto& c : counts_)
+			c = 0;
+	}
+
+	void record(std::chrono::nanoseconds duration)
+	{
+		auto ns = uint64_t(std::max<int64_t>(duration.count(), 0));
+		auto us = ns / 1000;
+
+		const auto& bounds = bounds_us();
+		size_t bucket = 0;
+		while (bucket < num_bounds && us > bounds[bucket])
+			++bucket;
+
+		counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+	}
+
+	statistics stats() const
+	{
+		statistics stats;
+		for (size_t i = 0; i < counts_.size(); ++i)
+			stats.counts[i] = counts_[i].load(std::memory_order_relaxed);
+		stats.count = count_.load(std::memory_order_relaxed);
+		stats.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+  private:
+	std::array<std::atomic<uint64_t>, num_bounds + 1> counts_;
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sum_ns_;
+};
+
+/// the counters of one connection. Updated by thrift_asio_transport and thrift_asio_server.
+struct connection_metrics
+{
+	explicit connection_metrics(const std::string& peer)
+		: peer(peer)
+		, bytes_in(0)
+		, bytes_out(0)
+		, frames_in(0)
+		, frames_out(0)
+		, outbound_queue_bytes(0)
+	{
+	}
+
+	const std::string peer; ///< the address of the other end
+	std::atomic<uint64_t> bytes_in;
+	std::atomic<uint64_t> bytes_out;
+	std::atomic<uint64_t> frames_in;
+	std::atomic<uint64_t> frames_out;
+	std::atomic<size_t> outbound_queue_bytes; ///< bytes written, but not yet sent
+};
+
+/// the calls of one RPC method
+struct method_metrics
+{
+	method_metrics()
+		: state(0)
+		, calls(0)
+		, failures(0)
+	{
+	}
+
+	std::atomic<int> state; ///< see metrics_registry::method
+	std::string name;
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> failures; ///< calls, whose processor reported an error
+	latency_histogram durations;    ///< the time spent processing a call
+
+	/// counts a processed call
+	void record(std::chrono::nanoseconds duration, bool success)
+	{
+		calls.fetch_add(1, std::memory_order_relaxed);
+		if (!success)
+			failures.fetch_add(1, std::memory_order_relaxed);
+		durations.record(duration);
+	}
+};
+
+/*!
+* Collects counters of a thrift_asio_server: bytes and frames in and out, the outbound
+* queue depth, connects and disconnects, and per RPC method the number of calls and a
+* histogram of their processing time.
+*
+* @code
+* auto metrics = std::make_shared<betabugs::networking::metrics_registry>();
+* thrift_asio_server<my_handler>::server_options options;
+* options.metrics = metrics;
+* ...
+* auto stats = metrics->stats(); // or
+* std::string text = metrics->prometheus_text(); // i.e. served by a /metrics endpoint
+* @endcode
+*
+* Counting is lock-free: every connection has its own counters, and the counters of a
+* method are looked up in a fixed-size table without locking. Only connecting, disconnecting
+* and taking a snapshot lock a mutex. Methods beyond max_methods are counted as "other".
+*
+* thrift_asio_server only counts the calls of methods, that the processor accepted, under
+* their name. Calls of methods, that the processor does not know, are counted as "unknown",
+* so that clients can't fill the table or create arbitrary labels.
+*
+* Define THRIFT_ASIO_NO_METRICS to compile the collection out entirely.
+* */
+class metrics_registry
+{
+  public:
+	static constexpr size_t max_methods = 256;
+
+	/// the metrics of one connection at one point in time
+	struct connection_statistics
+	{
+		std::string peer;
+		uint64_t bytes_in = 0;
+		uint64_t bytes_out = 0;
+		uint64_t frames_in = 0;
+		uint64_t frames_out = 0;
+		size_t outbound_queue_bytes = 0;
+	};
+
+	/// the metrics of one RPC method at one point in time
+	struct method_statistics
+	{
+		std::string name;
+		uint64_t calls = 0;
+		uint64_t failures = 0;
+		latency_histogram::statistics durations;
+	};
+
+	/// a snapshot of all metrics. The totals include connections, that are gone.
+	struct statistics
+	{
+		uint64_t connections_accepted = 0;
+		uint64_t connections_closed = 0;
+		uint64_t bytes_in = 0;
+		uint64_t bytes_out = 0;
+		uint64_t frames_in = 0;
+		uint64_t frames_out = 0;
+		size_t outbound_queue_bytes = 0; ///< of all open connections
+		std::vector<connection_statistics> connections; ///< the open connections
+		std::vector<method_statistics> methods;
+	};
+
+	metrics_registry()
+		: methods_(new method_metrics[max_methods + 2])
+	{
+		methods_[max_methods].name = "other";
+		methods_[max_methods].state = 2;
+		methods_[max_methods + 1].name = "unknown";
+		methods_[max_methods + 1].state = 2;
+	}
+
+	metrics_registry(const metrics_registry&) = delete;
+	metrics_registry& operator=(const metrics_registry&) = delete;
+
+	/// creates the counters of a new connection
+	std::shared_ptr<connection_metrics> add_connection(const std::string& peer)
+	{
+		auto c = std::make_shared<connection_metrics>(peer);
+
+		std::lock_guard<std::mutex> lock(connections_mutex_);
+		++closed_.connections_accepted;
+		connections_.push_back(c);
+		return c;
+	}
+
+	/// removes the counters of a connection, that is gone, and adds them to the totals
+	void remove_connection(const std::shared_ptr<connection_metrics>& c)
+	{
+		std::lock_guard<std::mutex> lock(connections_mutex_);
+		for (size_t i = 0; i < connections_.size(); ++i)
+		{
+			if (connections_[i] != c)
+				continue;
+
+			++closed_.connections_closed;
+			closed_.bytes_in += c->bytes_in;
+			closed_.bytes_out += c->bytes_out;
+			closed_.frames_in += c->frames_in;
+			closed_.frames_out += c->frames_out;
+
+			connections_[i] = std::move(connections_.back());
+			connections_.pop_back();
+			return;
+		}
+	}
+
+	/// the counters of the method called name. Lock-free, safe to call from any thread.
+	method_metrics& method(const std::string& name)
+	{
+		// open addressing. A slot is empty (0), being claimed (1) or holds a method (2).
+		// Slots are never released, so a name, that was found once, stays where it is.
+		size_t start = std::hash<std::string>()(name) % max_methods;
+		for (size_t i = 0; i < max_methods; ++i)
+		{
+			auto& m = methods_[(start + i) % max_methods];
+
+			int state = m.state.load(std::memory_order_acquire);
+			if (state == 0)
+			{
+				if (m.state.compare_exchange_strong(state, 1, std::memory_order_acquire))
+				{
+					m.name = name;
+					m.state.store(2, std::memory_order_release);
+					return m;
+				}
+			}
+
+			while (state == 1)
+				state = m.state.load(std::memory_order_acquire);
+
+			if (m.name == name)
+				return m;
+		}
+		return methods_[max_methods];
+	}
+
+	/// the counters of the calls, that no processor accepted
+	method_metrics& unknown_method()
+	{
+		return methods_[max_methods + 1];
+	}
+
+	/// a snapshot of all counters
+	statistics stats() const
+	{
+		statistics stats;
+		{
+			std::lock_guard<std::mutex> lock(connections_mutex_);
+			stats.connections_accepted = closed_.connections_accepted;
+			stats.connections_closed = closed_.connections_closed;
+			stats.bytes_in = closed_.bytes_in;
+			stats.bytes_out = closed_.bytes_out;
+			stats.frames_in = closed_.frames_in;
+			stats.frames_out = closed_.frames_out;
+
+			for (auto& c : connections_)
+			{
+				connection_statistics cs;
+				cs.peer = c->peer;
+				cs.bytes_in = c->bytes_in;
+				cs.bytes_out = c->bytes_out;
+				cs.frames_in = c->frames_in;
+				cs.frames_out = c->frames_out;
+				cs.outbound_queue_bytes = c->outbound_queue_bytes;
+
+				stats.bytes_in += cs.bytes_in;
+				stats.bytes_out += cs.bytes_out;
+				stats.frames_in += cs.frames_in;
+				stats.frames_out += cs.frames_out;
+				stats.outbound_queue_bytes += cs.outbound_queue_bytes;
+				stats.connections.push_back(std::move(cs));
+			}
+		}
+
+		for (size_t i = 0; i < max_methods + 2; ++i)
+		{
+			auto& m = methods_[i];
+			if (m.state.load(std::memory_order_acquire) != 2 || m.calls == 0)
+				continue;
+
+			method_statistics ms;
+			ms.name = m.name;
+			ms.calls = m.calls;
+			ms.failures = m.failures;
+			ms.durations = m.durations.stats();
+			stats.methods.push_back(std::move(ms));
+		}
+		return stats;
+	}
+
+	/// writes stats() in the Prometheus text exposition format
+	/*!
+	* @param per_connection also export the counters of every open connection, labeled with its peer.
+	*                       Beware of the number of time series with many connections.
+	* */
+	void write_prometheus(std::ostream& out, bool per_connection = false) const
+	{
+		auto s = stats();
+
+		write_metric(out, "thrift_asio_connections_accepted_total", "counter", "Connections accepted.", s.connections_accepted);
+		write_metric(out, "thrift_asio_connections_closed_total", "counter", "Connections closed.", s.connections_closed);
+		write_metric(out, "thrift_asio_connections", "gauge", "Open connections.", s.connections_accepted - s.connections_closed);
+		write_metric(out, "thrift_asio_received_bytes_total", "counter", "Bytes received.", s.bytes_in);
+		write_metric(out, "thrift_asio_sent_bytes_total", "counter", "Bytes sent.", s.bytes_out);
+		write_metric(out, "thrift_asio_received_frames_total", "counter", "Frames received.", s.frames_in);
+		write_metric(out, "thrift_asio_sent_frames_total", "counter", "Frames queued for sending.", s.frames_out);
+		write_metric(out, "thrift_asio_outbound_queue_bytes", "gauge", "Bytes waiting to be sent.", s.outbound_queue_bytes);
+
+		if (per_connection)
+		{
+			write_header(out, "thrift_asio_connection_received_bytes_total", "counter", "Bytes received per connection.");
+			for (auto& c : s.connections)
+				out << "thrift_asio_connection_received_bytes_total{peer=\"" << escape(c.peer) << "\"} " << c.bytes_in << "\n";
+			write_header(out, "thrift_asio_connection_sent_bytes_total", "counter", "Bytes sent per connection.");
+			for (auto& c : s.connections)
+				out << "thrift_asio_connection_sent_bytes_total{peer=\"" << escape(c.peer) << "\"} " << c.bytes_out << "\n";
+			write_header(out, "thrift_asio_connection_outbound_queue_bytes", "gauge", "Bytes waiting to be sent per connection.");
+			for (auto& c : s.connections)
+				out << "thrift_asio_connection_outbound_queue_bytes{peer=\"" << escape(c.peer) << "\"} " << c.outbound_queue_bytes << "\n";
+		}
+
+		write_header(out, "thrift_asio_calls_total", "counter", "RPC calls processed.");
+		for (auto& m : s.methods)
+			out << "thrift_asio_calls_total{method=\"" << escape(m.name) << "\"} " << m.calls << "\n";
+
+		write_header(out, "thrift_asio_call_failures_total", "counter", "RPC calls, that failed.");
+		for (auto& m : s.methods)
+			out << "thrift_asio_call_failures_total{method=\"" << escape(m.name) << "\"} " << m.failures << "\n";
+
+		write_header(out, "thrift_asio_call_duration_seconds", "histogram", "Time spent processing RPC calls.");
+		const auto& bounds = latency_histogram::bounds_us();
+		for (auto& m : s.methods)
+		{
+			auto method = escape(m.name);
+			uint64_t cumulative = 0;
+			for (size_t i = 0; i < bounds.size(); ++i)
+			{
+				cumulative += m.durations.counts[i];
+				out << "thrift_asio_call_duration_seconds_bucket{method=\"" << method << "\",le=\""
+					<< double(bounds[i]) / 1e6 << "\"} " << cumulative << "\n";
+			}
+			out << "thrift_asio_call_duration_seconds_bucket{method=\"" << method << "\",le=\"+Inf\"} " << m.durations.count << "\n";
+			out << "thrift_asio_call_duration_seconds_sum{method=\"" << method << "\"} " << double(m.durations.sum_ns) / 1e9 << "\n";
+			out << "thrift_asio_call_duration_seconds_count{method=\"" << method << "\"} " << m.durations.count << "\n";
+		}
+	}
+
+	/// like write_prometheus, but returns the text
+	std::string prometheus_text(bool per_connection = false) const
+	{
+		std::ostringstream out;
+		write_prometheus(out, per_connection);
+		return out.str();
+	}
+
+  private:
+	std::unique_ptr<method_metrics[]> methods_; ///< max_methods slots, "other" and "unknown"
+
+	mutable std::mutex connections_mutex_; ///< guards connections_ and closed_
+	std::vector<std::shared_ptr<connection_metrics>> connections_;
+	statistics closed_; ///< the totals of the connections, that are gone
+
+	static void write_header(std::ostream& out, const char* name, const char* type, const char* help)
+	{
+		out << "# HELP " << name << " " << help << "\n"
+			<< "# TYPE " << name << " " << type << "\n";
+	}
+
+	template <typename T>
+	static void write_metric(std::ostream& out, const char* name, const char* type, const char* help, T value)
+	{
+		write_header(out, name, type, help);
+		out << name << " " << value << "\n";
+	}
+
+	// escapes a label value
+	static std::string escape(const std::string& value)
+	{
+		std::string escaped;
+		escaped.reserve(value.size());
+		for (char c : value)
+		{
+			if (c == '\\' || c == '"')
+				escaped += '\\';
+			if (c == '\n')
+			{
+				escaped += "\\n";
+				continue;
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_METRICS_HPP_
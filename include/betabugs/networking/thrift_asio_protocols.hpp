@@ -0,0 +1,50 @@
+#ifndef _THRIFT_ASIO_PROTOCOLS_HPP_
+#define _THRIFT_ASIO_PROTOCOLS_HPP_
+
+#pragma once
+
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/protocol/TCompactProtocol.h>
+
+namespace betabugs {
+namespace networking {
+
+/*!
+* \section ProtocolPolicy ProtocolPolicy
+*   thrift_asio_server, thrift_asio_client and thrift_asio_connection_management_mixin take
+*   the thrift protocol as a policy, so that it can be chosen per service. Both ends of a
+*   connection must use the same one.
+*
+*   A ProtocolPolicy provides an alias template, that maps a transport type to a protocol
+*   on top of it:
+*
+*   @code
+*   struct my_protocol
+*   {
+*     template <typename Transport>
+*     using type = MyProtocolT<Transport>;
+*   };
+*   @endcode
+*
+*   Where the concrete transport is known (i.e. the TMemoryBuffer the server decodes a frame from),
+*   it is passed instead of TTransport, so that the protocol reads from it without virtual calls.
+* */
+
+/// TBinaryProtocol: fast to encode and decode, the default
+struct binary_protocol
+{
+	template <typename Transport>
+	using type = apache::thrift::protocol::TBinaryProtocolT<Transport>;
+};
+
+/// TCompactProtocol: variable length integers, trades some CPU for fewer bytes on the wire
+struct compact_protocol
+{
+	template <typename Transport>
+	using type = apache::thrift::protocol::TCompactProtocolT<Transport>;
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_PROTOCOLS_HPP_
@@ -9,12 +9,24 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/asio.hpp>
+#include <chrono>
 #include <thrift/TProcessor.h>
+#include <thrift/async/TAsyncProcessor.h>
 #include <thrift/transport/TBufferTransports.h>
-#include <thrift/transport/TZlibTransport.h>
-#include <thrift/protocol/TBinaryProtocol.h>
-#include <iostream>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "./io_service_pool.hpp"
+#include "./ring_buffer.hpp"
+#include "./thrift_asio_framed_transport.hpp"
+#include "./thrift_asio_log.hpp"
+#include "./thrift_asio_metrics.hpp"
+#include "./thrift_asio_protocols.hpp"
+#include "./thrift_asio_trace.hpp"
 #include "./thrift_asio_transport.hpp"
+#include "./worker_pool.hpp"
 
 namespace betabugs{
 namespace networking{
@@ -23,7 +35,8 @@ namespace networking{
 * Use this class on the server
 *
 * \tparam HandlerType the type of the implementation of a handler.
-* \tparam use_compression whether to wrap the transport into a TZlibTransport or not
+* \tparam use_compression whether to compress frames with zlib by default, see server_options::compression
+* \tparam ProtocolPolicy the thrift protocol, i.e. binary_protocol or compact_protocol (see thrift_asio_protocols.hpp)
 *
 * \section HandlerType HandlerType
 *   First of all the HandlerType must work with the auto-generated processor you're using.
@@ -38,22 +51,226 @@ namespace networking{
 *   void after_process();
 *   @endcode
 *
-*   or you can simply inherit your server side handler from thrift_asio_connection_management_mixin
+*   on_client_connected may also return a connection context instead, i.e. a pointer to the
+*   session of the client. Then the context is passed to before_process and on_client_disconnected
+*   as an additional last argument, so that the handler does not have to look up the connection:
+*
+*   @code
+*   context_type on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol);
+*   void on_client_disconnected(const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol, const boost::system::error_code& ec, const context_type& context);
+*   void before_process(const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol, const context_type& context);
+*   @endcode
+*
+*   or you can simply inherit your server side handler from thrift_asio_connection_management_mixin,
+*   which does the latter.
+*
+*   The output protocol writes to a thrift_asio_framed_transport directly, so it is not a
+*   TBinaryProtocol (or the ProtocolPolicy's protocol on a TTransport) anymore. Handlers, whose
+*   before_process still takes that type, keep working: all of their callbacks receive such a
+*   protocol, that writes to the same transport through the virtual TTransport interface.
+*
+* \section Threading Threading
+*   The io_service may be run by multiple threads. Everything that happens on one
+*   connection (reading, before_process, process, after_process and writing) is
+*   serialized by the strand of its transport, so requests of one client are still
+*   processed in order, but requests of different clients are processed concurrently.
+*   In that case the handler and the processor must be safe to be called concurrently
+*   for different connections. thrift_asio_connection_management_mixin takes care of this
+*   for the connection management.
+*
+* \section AsyncProcessor Asynchronous handlers
+*   A handler, that has to wait for something (i.e. a database), would stall every other
+*   connection on the same thread. Generate the code with `thrift -gen cpp:cob_style` and
+*   pass the generated AsyncProcessor to serve() instead. Its handler receives a callback
+*   (cob) per request, that can be called later from any thread:
+*
+*   @code
+*   void add(tcxx::function<void(int32_t const& _return)> cob, const int32_t a, const int32_t b) override
+*   {
+*     database.async_query(..., [cob](int32_t result){ cob(result); });
+*   }
+*   @endcode
+*
+*   The reply is sent on the strand of the connection. before_process and after_process
+*   are called around the call to the processor, not around the completion.
+*   server_options::max_pending_requests controls, how many requests of one connection
+*   may be pending at the same time.
+*
+*   With C++20, the handler can be written as a coroutine, that calls the cob, when it is
+*   done (see thrift_asio_coroutine.hpp).
+*
+* \section Workers CPU-heavy handlers
+*   Handlers, that compute for a while, starve the I/O of all connections on the same thread.
+*   Set server_options::workers to run them on a worker_pool instead. The frame is decoded,
+*   processed and the reply is serialized on a worker thread, then the reply is sent on the
+*   strand of the connection. server_options::offload selects, which methods are processed
+*   by the workers. max_pending_requests applies to them, as if they were asynchronous.
+*
+*   Like for asynchronous handlers, before_process and after_process are called on the strand
+*   around handing the frame over, not around the call on the worker. Only offload handlers,
+*   that answer through their return value. Handlers, that write to the connection from
+*   within the call, i.e. to current_client of thrift_asio_connection_management_mixin, must
+*   not be offloaded: there is no current client on the worker and the strand writes to the
+*   same output_protocol. Use post() to write to a connection from a worker.
+*
+*   Tasks, that are queued, when the worker_pool is stopped, are still run, so every
+*   offloaded request is completed.
+*
+* \section Metrics Metrics
+*   Set server_options::metrics to a metrics_registry to count bytes, frames, connections
+*   and the calls per method with a histogram of their processing time. For asynchronous
+*   handlers, that is the time until the cob was called. Read them with
+*   metrics_registry::stats() or metrics_registry::prometheus_text().
+*
+* \section Logging Logging
+*   Errors and disconnects are passed to current_logger() (see thrift_asio_log.hpp). By default
+*   an async_logger writes them to std::clog from a background thread, so the io_service threads
+*   never wait for the stream.
+*
+* \section Tracing Tracing
+*   Set server_options::tracer to record timestamps of sampled requests: when their frame
+*   started to arrive and was complete, when the processor was called and returned, and when
+*   the frames written meanwhile were queued and sent (see thrift_asio_trace.hpp). A trace_buffer
+*   keeps the latest of them and writes them as Chrome trace JSON.
 * */
-template <typename HandlerType, bool use_compression=false>
+template <typename HandlerType, bool use_compression=false, typename ProtocolPolicy=binary_protocol>
 class thrift_asio_server
 {
 	typedef boost::shared_ptr<HandlerType> Handler_ptr;
+	typedef boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol_ptr;
+
+	// whatever HandlerType::on_client_connected returns, see \ref HandlerType
+	typedef typename std::decay<decltype(
+		std::declval<HandlerType&>().on_client_connected(std::declval<protocol_ptr>())
+	)>::type connect_result;
+
+	typedef std::integral_constant<bool, !std::is_void<connect_result>::value> has_connection_context;
+
+	// nullptr_t, if the handler does not use a connection context
+	typedef typename std::conditional<
+		has_connection_context::value, connect_result, std::nullptr_t
+	>::type connection_context;
 
 	// forward typedefs to minimize pollution
 	typedef apache::thrift::TProcessor TProcessor;
+	typedef apache::thrift::async::TAsyncProcessor TAsyncProcessor;
 	typedef apache::thrift::transport::TMemoryBuffer TMemoryBuffer;
-	typedef apache::thrift::transport::TZlibTransport TZlibTransport;
-	typedef apache::thrift::transport::TFramedTransport TFramedTransport;
-	typedef apache::thrift::protocol::TBinaryProtocol TBinaryProtocol;
+
+	// the output protocol writes to a thrift_asio_framed_transport directly
+	typedef typename ProtocolPolicy::template type<thrift_asio_framed_transport> output_protocol_type;
+	// frames are always decoded from a TMemoryBuffer, so the input protocol can read from it directly
+	typedef typename ProtocolPolicy::template type<TMemoryBuffer> input_protocol_type;
+	// replies of asynchronous handlers are buffered, until the handler completes
+	typedef typename ProtocolPolicy::template type<TMemoryBuffer> reply_protocol_type;
+
+	// the type of the output protocol, before it wrote to the thrift_asio_framed_transport
+	// directly, i.e. TBinaryProtocol
+	typedef typename ProtocolPolicy::template type<apache::thrift::transport::TTransport> legacy_protocol_type;
+
+	// true, if HandlerType::before_process can be called with a boost::shared_ptr<Protocol>
+	template <typename Protocol>
+	struct before_process_takes
+	{
+		template <typename H>
+		static auto test(H* h, std::false_type)
+			-> decltype(h->before_process(std::declval<boost::shared_ptr<Protocol>>()), std::true_type());
+
+		template <typename H>
+		static auto test(H* h, std::true_type)
+			-> decltype(h->before_process(std::declval<boost::shared_ptr<Protocol>>(), std::declval<const connection_context&>()), std::true_type());
+
+		template <typename H>
+		static std::false_type test(...);
+
+		static constexpr bool value = decltype(test<HandlerType>(nullptr, has_connection_context()))::value;
+	};
+
+	// handlers, that still take the output protocol as legacy_protocol_type, get one of that
+	// type in all of their callbacks. It writes to the same thrift_asio_framed_transport.
+	typedef std::integral_constant<bool,
+		!before_process_takes<output_protocol_type>::value && before_process_takes<legacy_protocol_type>::value
+	> uses_legacy_protocol;
+
+	// the output protocol, that is passed to the handler
+	typedef typename std::conditional<
+		uses_legacy_protocol::value, legacy_protocol_type, output_protocol_type
+	>::type handler_protocol_type;
 
   public:
 	typedef std::shared_ptr<boost::asio::ip::tcp::acceptor> acceptor_ptr;
+	typedef thrift_asio_transport::receive_buffer_options receive_buffer_options;
+	typedef thrift_asio_transport::outbound_queue_options outbound_queue_options;
+
+	/*!
+	* Limits, that protect the server from too many or misbehaving clients.
+	*
+	* All limits but max_pending_requests are disabled (zero) by default.
+	* */
+	struct server_options
+	{
+		server_options()
+			: max_connections(0)
+			, max_frame_size(0)
+			, outbound_high_water_mark(0)
+			, max_pending_requests(1)
+			, accept_retry_delay(boost::posix_time::milliseconds(100))
+		{
+			if (use_compression)
+				compression.codec = compression_codec::zlib;
+		}
+
+		/// Incoming data is read in chunks of at least receive_buffer.initial_size bytes.
+		/// With receive_buffer.adaptive, the chunk size of each connection follows its traffic.
+		receive_buffer_options receive_buffer;
+
+		/// While this many clients are connected, no new connections are accepted.
+		/// With multiple acceptors (see serve(io_service_pool&, ...)), each of them
+		/// might accept one more connection, before it pauses.
+		size_t max_connections;
+
+		/// Connections, that announce a bigger frame, are closed before the frame is read.
+		/// Compressed frames are also rejected, if they decompress to more bytes.
+		/// 0 disables the limit, but compressed frames are still bound by
+		/// compression.max_decompressed_size then.
+		uint32_t max_frame_size;
+
+		/// While more bytes are queued for a client, no requests are read from it.
+		/// Reading resumes, once half of them were sent.
+		size_t outbound_high_water_mark;
+
+		/// Bounds the bytes queued for a client, i.e. by broadcasts from other connections.
+		/// Unlike outbound_high_water_mark, this also applies to writes, that are not
+		/// responses to the client's own requests.
+		outbound_queue_options outbound_queue;
+
+		/// How frames sent to clients are compressed. Compressed frames from clients are
+		/// decompressed regardless of this.
+		compression_options compression;
+
+		/// Only used with a TAsyncProcessor: the number of requests of one connection, that may
+		/// be pending at the same time. No frames are processed, while that many are pending.
+		/// With more than one, replies might be sent in another order, than the requests were
+		/// received. Clients match them by their sequence id (see thrift_asio_client::async_call).
+		size_t max_pending_requests;
+
+		/// If set, requests are processed by these workers instead of the io_service threads.
+		/// Only used with a TProcessor. Reading pauses, while the queue of the workers is full.
+		std::shared_ptr<worker_pool> workers;
+
+		/// If set, only the methods, that it returns true for, are processed by the workers.
+		/// The others are processed on the io_service thread, as without workers.
+		std::function<bool(const std::string& method)> offload;
+
+		/// If set, the connections and calls are counted into it. It may be shared by several servers.
+		std::shared_ptr<metrics_registry> metrics;
+
+		/// If set, the sampled requests are traced from their first byte to their reply.
+		std::shared_ptr<networking::tracer> tracer;
+
+		/// If accepting fails, because the process or the system ran out of file descriptors,
+		/// the next accept is started after this delay. Other errors are retried right away.
+		boost::posix_time::time_duration accept_retry_delay;
+	};
 
 	/*!
 	* call this to start listening for incoming connections.
@@ -74,6 +291,17 @@ class thrift_asio_server
 	* need no (or a lot less) locking. This is much more suitable for a "realtime"
 	* environment.
 	*
+	* To use more than one core, run the io_service from multiple threads:
+	*
+	* @code
+	* std::vector<std::thread> threads;
+	* for (unsigned i = 0; i < std::thread::hardware_concurrency(); ++i)
+	*   threads.emplace_back([&io_service]{ io_service.run(); });
+	* @endcode
+	*
+	* All complete frames in a chunk of received data are processed, before the next
+	* read is issued. So pipelining clients cause only one read completion for many frames.
+	*
 	* @returns acceptor_ptr, so that you can stop listening
 	*
 	* */
@@ -81,8 +309,251 @@ class thrift_asio_server
 		boost::asio::io_service& io_service,
 		TProcessor& processor,
 		Handler_ptr handler,
-		unsigned short port
+		unsigned short port,
+		const server_options& options = server_options()
+	)
+	{
+		return listen(io_service, std::make_shared<listener>(&processor, nullptr, handler, options), port);
+	}
+
+	/// like serve(io_service, processor, ...), but with the processor of asynchronous handlers
+	static acceptor_ptr serve(
+		boost::asio::io_service& io_service,
+		TAsyncProcessor& processor,
+		Handler_ptr handler,
+		unsigned short port,
+		const server_options& options = server_options()
+	)
+	{
+		return listen(io_service, std::make_shared<listener>(nullptr, &processor, handler, options), port);
+	}
+
+	/*!
+	* Starts listening for incoming connections on every io_service of pool.
+	*
+	* Each io_service of the pool is a shard: a connection is accepted by and stays on
+	* one shard, so there is no locking between shards on the hot path. Where SO_REUSEPORT
+	* is available, every shard gets its own acceptor bound to port and the kernel balances
+	* new connections. Otherwise a single acceptor hands the accepted sockets to the shards
+	* in a round-robin fashion.
+	*
+	* The handler and the processor are shared by all shards, so they must be safe to be
+	* called concurrently. Call pool.run() to service the clients. The pool must outlive
+	* the acceptors.
+	*
+	* @returns the acceptors, so that you can stop listening
+	* */
+	static std::vector<acceptor_ptr> serve(
+		io_service_pool& pool,
+		TProcessor& processor,
+		Handler_ptr handler,
+		unsigned short port,
+		const server_options& options = server_options()
+	)
+	{
+		return listen(pool, std::make_shared<listener>(&processor, nullptr, handler, options), port);
+	}
+
+	/// like serve(pool, processor, ...), but with the processor of asynchronous handlers
+	static std::vector<acceptor_ptr> serve(
+		io_service_pool& pool,
+		TAsyncProcessor& processor,
+		Handler_ptr handler,
+		unsigned short port,
+		const server_options& options = server_options()
 	)
+	{
+		return listen(pool, std::make_shared<listener>(nullptr, &processor, handler, options), port);
+	}
+
+	/*!
+	* Runs f on the shard and strand of the connection, that output_protocol belongs to.
+	*
+	* Use this to hand work to other connections, i.e. when broadcasting from a sharded
+	* or multi-threaded server. f must be callable without arguments.
+	* */
+	template <typename Function>
+	static void post(const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol, Function f)
+	{
+		auto transport = get_transport(output_protocol);
+		assert(transport);
+		transport->strand().post(f);
+	}
+
+	/// returns the thrift_asio_transport, that output_protocol writes to
+	static boost::shared_ptr<thrift_asio_transport> get_transport(
+		const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol
+	)
+	{
+		auto t = output_protocol->getTransport();
+		return boost::static_pointer_cast<thrift_asio_framed_transport>(t)->getUnderlyingTransport();
+	}
+
+  private:
+	// state shared by all connections, that were accepted by one call to serve()
+	struct listener
+	{
+		listener(TProcessor* processor, TAsyncProcessor* async_processor, Handler_ptr handler, const server_options& options)
+			: processor(processor)
+			, async_processor(async_processor)
+			, handler(handler)
+			, options(options)
+			, num_connections(0)
+		{
+			// fail here instead of on the first accepted connection
+			if (!frame_codec::is_supported(options.compression.codec))
+			{
+				throw apache::thrift::transport::TTransportException(
+					apache::thrift::transport::TTransportException::BAD_ARGS,
+					"compression codec is not compiled in"
+				);
+			}
+
+			if (metrics_enabled && options.metrics)
+			{
+				if (processor)
+					call_acceptance::install(*processor);
+				else
+					call_acceptance::install(*async_processor);
+			}
+		}
+
+		TProcessor* processor; ///< either this
+		TAsyncProcessor* async_processor; ///< or this is set
+		Handler_ptr handler;
+		const server_options options;
+
+		std::mutex accept_mutex; ///< guards num_connections and paused_accepts
+		size_t num_connections;
+		std::vector<std::function<void()>> paused_accepts; ///< posted to the io_service of their acceptor, when a client disconnects
+	};
+
+	typedef std::shared_ptr<listener> listener_ptr;
+
+	/*!
+	* Tells the metrics, whether the processor accepted a call. Generated processors ask their
+	* event handler for a context only for the methods, they know, so a call, that did not do
+	* so while the processor ran, is counted as "unknown". Installed in front of the event
+	* handler, that the processor had, which is called as before.
+	* */
+	class call_acceptance : public apache::thrift::TProcessorEventHandler
+	{
+	  public:
+		explicit call_acceptance(boost::shared_ptr<apache::thrift::TProcessorEventHandler> next)
+			: next_(std::move(next))
+		{
+		}
+
+		template <typename Processor>
+		static void install(Processor& processor)
+		{
+			auto previous = processor.getEventHandler();
+			if (!boost::dynamic_pointer_cast<call_acceptance>(previous)) // once per processor
+				processor.setEventHandler(boost::make_shared<call_acceptance>(previous));
+		}
+
+		/// marks the calls, that the current thread passes to a processor, as accepted in is_accepted
+		class scope
+		{
+		  public:
+			explicit scope(bool* is_accepted)
+				: previous_(current())
+			{
+				current() = is_accepted;
+			}
+
+			~scope()
+			{
+				current() = previous_;
+			}
+
+			scope(const scope&) = delete;
+			scope& operator=(const scope&) = delete;
+
+		  private:
+			bool* previous_;
+		};
+
+		virtual void* getContext(const char* fn_name, void* server_context) override
+		{
+			if (current())
+				*current() = true;
+			return next_ ? next_->getContext(fn_name, server_context) : nullptr;
+		}
+
+		virtual void freeContext(void* ctx, const char* fn_name) override
+		{
+			if (next_) next_->freeContext(ctx, fn_name);
+		}
+
+		virtual void preRead(void* ctx, const char* fn_name) override
+		{
+			if (next_) next_->preRead(ctx, fn_name);
+		}
+
+		virtual void postRead(void* ctx, const char* fn_name, uint32_t bytes) override
+		{
+			if (next_) next_->postRead(ctx, fn_name, bytes);
+		}
+
+		virtual void preWrite(void* ctx, const char* fn_name) override
+		{
+			if (next_) next_->preWrite(ctx, fn_name);
+		}
+
+		virtual void postWrite(void* ctx, const char* fn_name, uint32_t bytes) override
+		{
+			if (next_) next_->postWrite(ctx, fn_name, bytes);
+		}
+
+		virtual void asyncComplete(void* ctx, const char* fn_name) override
+		{
+			if (next_) next_->asyncComplete(ctx, fn_name);
+		}
+
+		virtual void handlerError(void* ctx, const char* fn_name) override
+		{
+			if (next_) next_->handlerError(ctx, fn_name);
+		}
+
+	  private:
+		boost::shared_ptr<apache::thrift::TProcessorEventHandler> next_;
+
+		// the flag of the call, that the current thread is processing, if it is counted
+		static bool*& current()
+		{
+			static thread_local bool* is_accepted = nullptr;
+			return is_accepted;
+		}
+	};
+
+	// the metrics of one call. It's counted under its method, once the processor accepted it.
+	struct call_metrics
+	{
+		call_metrics(metrics_registry* registry, std::string method)
+			: registry(registry)
+			, method(std::move(method))
+			, is_accepted(false)
+			, start(registry ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+		{
+		}
+
+		metrics_registry* registry; ///< nullptr, if the call is not counted
+		std::string method;
+		bool is_accepted;
+		std::chrono::steady_clock::time_point start;
+
+		void record(bool success)
+		{
+			if (!registry)
+				return;
+
+			auto& m = is_accepted ? registry->method(method) : registry->unknown_method();
+			m.record(std::chrono::steady_clock::now() - start, success);
+		}
+	};
+
+	static acceptor_ptr listen(boost::asio::io_service& io_service, listener_ptr listener, unsigned short port)
 	{
 		using boost::asio::ip::tcp;
 
@@ -92,133 +563,726 @@ class thrift_asio_server
 			true
 		);
 
-		start_accept(io_service, acceptor, processor, handler);
+		start_accept(io_service, acceptor, listener);
 		return acceptor;
 	}
 
-  private:
+	static std::vector<acceptor_ptr> listen(io_service_pool& pool, listener_ptr l, unsigned short port)
+	{
+		using boost::asio::ip::tcp;
+
+		std::vector<acceptor_ptr> acceptors;
+		const tcp::endpoint endpoint(tcp::v4(), port);
+
+#ifdef SO_REUSEPORT
+		typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+		for (size_t i = 0; i < pool.size(); ++i)
+		{
+			auto& io_service = pool.get_io_service(i);
+			auto acceptor = std::make_shared<tcp::acceptor>(io_service);
+			acceptor->open(endpoint.protocol());
+			acceptor->set_option(tcp::acceptor::reuse_address(true));
+			acceptor->set_option(reuse_port(true));
+			acceptor->bind(endpoint);
+			acceptor->listen();
+
+			start_accept(io_service, acceptor, l);
+			acceptors.push_back(acceptor);
+		}
+#else
+		auto acceptor = std::make_shared<tcp::acceptor>(pool.get_io_service(0), endpoint, true);
+		start_accept(pool, acceptor, l);
+		acceptors.push_back(acceptor);
+#endif
+
+		return acceptors;
+	}
+
 	static void start_accept(
 		boost::asio::io_service& io_service,
 		std::shared_ptr<boost::asio::ip::tcp::acceptor> acceptor,
-		TProcessor& processor,
-		Handler_ptr handler
+		listener_ptr listener
+	)
+	{
+		using boost::asio::ip::tcp;
+
+		auto socket = std::make_shared<tcp::socket>(io_service);
+		acceptor->async_accept(
+			*socket,
+			[&io_service, acceptor, socket, listener]
+				(boost::system::error_code ec)
+			{
+				if (ec)
+				{
+					retry_accept(ec, listener, acceptor, [&io_service, acceptor, listener]
+					{
+						start_accept(io_service, acceptor, listener);
+					});
+				}
+				else
+				{
+					THRIFT_ASIO_LOG(log_level::debug, "client connected");
+					on_accept(io_service, socket, listener);
+
+					accept_next(listener, *acceptor, [&io_service, acceptor, listener]
+					{
+						start_accept(io_service, acceptor, listener);
+					});
+				}
+			}
+		);
+	}
+
+	// accept into sockets of the pool's io_services in turn
+	static void start_accept(
+		io_service_pool& pool,
+		std::shared_ptr<boost::asio::ip::tcp::acceptor> acceptor,
+		listener_ptr listener
 	)
 	{
 		using boost::asio::ip::tcp;
 
+		auto& io_service = pool.next_io_service();
 		auto socket = std::make_shared<tcp::socket>(io_service);
 		acceptor->async_accept(
 			*socket,
-			[&io_service, acceptor, socket, &processor, handler]
+			[&pool, &io_service, acceptor, socket, listener]
 				(boost::system::error_code ec)
 			{
 				if (ec)
 				{
-					std::clog << ec.message() << std::endl;
+					retry_accept(ec, listener, acceptor, [&pool, acceptor, listener]
+					{
+						start_accept(pool, acceptor, listener);
+					});
 				}
 				else
 				{
-					std::clog << "client connected" << std::endl;
-					on_accept(io_service, socket, processor, handler);
+					THRIFT_ASIO_LOG(log_level::debug, "client connected");
 
-					// Note: this will accept new connections without any bounds
-					start_accept(io_service, acceptor, processor, handler);
+					// the connection lives on the shard of its socket
+					io_service.post([&io_service, socket, listener]
+					{
+						on_accept(io_service, socket, listener);
+					});
+
+					accept_next(listener, *acceptor, [&pool, acceptor, listener]
+					{
+						start_accept(pool, acceptor, listener);
+					});
 				}
 			}
 		);
 	}
 
+	// logs a failed accept and starts the next one, unless the acceptor was closed.
+	// Without file descriptors, accepting right away would fail again, so it waits
+	// for accept_retry_delay then, to give the connections time to close.
+	static void retry_accept(
+		const boost::system::error_code& ec,
+		const listener_ptr& listener,
+		const std::shared_ptr<boost::asio::ip::tcp::acceptor>& acceptor,
+		std::function<void()> start_accepting
+	)
+	{
+		if (ec == boost::asio::error::operation_aborted || !acceptor->is_open())
+			return;
+
+		THRIFT_ASIO_LOG(log_level::error, "accept failed", {{"error", ec}});
+
+		if (ec != boost::asio::error::no_descriptors && ec != boost::system::errc::too_many_files_open_in_system)
+			return start_accepting();
+
+		auto timer = std::make_shared<boost::asio::deadline_timer>(acceptor->get_io_service(), listener->options.accept_retry_delay);
+		timer->async_wait([timer, acceptor, start_accepting](const boost::system::error_code&)
+		{
+			if (acceptor->is_open())
+				start_accepting();
+		});
+	}
+
+	// counts the accepted connection and starts accepting the next one,
+	// unless max_connections is reached. Then it is resumed on the io_service of the acceptor,
+	// because connections close on the threads of their own shards.
+	static void accept_next(
+		const listener_ptr& listener,
+		boost::asio::ip::tcp::acceptor& acceptor,
+		std::function<void()> start_accepting
+	)
+	{
+		{
+			std::lock_guard<std::mutex> lock(listener->accept_mutex);
+			++listener->num_connections;
+
+			auto max_connections = listener->options.max_connections;
+			if (max_connections != 0 && listener->num_connections >= max_connections)
+			{
+				THRIFT_ASIO_LOG(log_level::warning, "max_connections reached, pausing accept",
+					{{"max_connections", max_connections}});
+				auto& io_service = acceptor.get_io_service();
+				listener->paused_accepts.push_back([&io_service, start_accepting]
+				{
+					io_service.post(start_accepting);
+				});
+				return;
+			}
+		}
+
+		start_accepting();
+	}
+
+	// called, when an accepted connection is gone. Resumes accepting, if it was paused
+	static void on_connection_closed(const listener_ptr& listener)
+	{
+		std::function<void()> start_accepting;
+		{
+			std::lock_guard<std::mutex> lock(listener->accept_mutex);
+			assert(listener->num_connections > 0);
+			--listener->num_connections;
+
+			if (!listener->paused_accepts.empty())
+			{
+				start_accepting = std::move(listener->paused_accepts.back());
+				listener->paused_accepts.pop_back();
+			}
+		}
+
+		if (start_accepting)
+			start_accepting();
+	}
+
+	// state of one connection. It owns everything, that is needed to decode
+	// a frame, so that reading and processing frames does not allocate.
+	struct session
+	{
+		session(
+			boost::asio::io_service& io_service,
+			std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+			listener_ptr listener,
+			boost::shared_ptr<thrift_asio_transport> transport,
+			boost::shared_ptr<output_protocol_type> output_protocol,
+			boost::shared_ptr<handler_protocol_type> handler_protocol,
+			connection_context context
+		)
+			: io_service(io_service)
+			, socket(socket)
+			, transport(transport)
+			, strand(transport->strand())
+			, listener(listener)
+			, output_protocol(output_protocol)
+			, handler_protocol(handler_protocol)
+			, context(std::move(context))
+			, missing_bytes(0)
+			, incomming_bytes(transport->receive_buffer())
+			, codec(listener->options.compression)
+			, input_transport(boost::make_shared<TMemoryBuffer>())
+			, input_protocol(boost::make_shared<input_protocol_type>(input_transport))
+			, pending_requests(0)
+			, is_paused(false)
+		{
+		}
+
+		boost::asio::io_service& io_service;
+		std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+		boost::shared_ptr<thrift_asio_transport> transport; ///< the transport of output_protocol
+		boost::asio::io_service::strand& strand; ///< owned by transport
+		listener_ptr listener; ///< holds the processor, the handler and the options
+		boost::shared_ptr<output_protocol_type> output_protocol;
+		boost::shared_ptr<handler_protocol_type> handler_protocol; ///< output_protocol, unless uses_legacy_protocol
+		connection_context context; ///< returned by handler->on_client_connected
+
+		size_t missing_bytes; ///< number of bytes missing to complete the current frame
+		ring_buffer& incomming_bytes; ///< received, but not yet processed bytes. Owned by transport.
+		std::vector<uint8_t> frame_bytes; ///< only used for frames, that wrap around in incomming_bytes
+		frame_codec codec; ///< decompresses incoming frames
+		std::vector<uint8_t> decompressed_bytes; ///< the current frame, if it was compressed
+		boost::shared_ptr<TMemoryBuffer> input_transport; ///< observes the current frame
+		boost::shared_ptr<input_protocol_type> input_protocol;
+
+		size_t pending_requests; ///< requests of asynchronous handlers, that were not completed yet
+		bool is_paused; ///< true, if frames are not processed, until a pending request completes
+		std::shared_ptr<connection_metrics> metrics; ///< only set, if server_options::metrics is
+
+		// only used, if server_options::tracer is set
+		uint64_t trace_connection_id = 0;
+		tracer::clock::time_point received_at; ///< of the last read
+		tracer::clock::time_point frame_started_at; ///< of the frame, that is partially received
+		bool has_partial_frame = false;
+	};
+
+	typedef std::shared_ptr<session> session_ptr;
+
 	// called when a new client connection was established (accepted)
 	static void on_accept(
 		boost::asio::io_service& io_service,
 		std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-		TProcessor& processor,
-		Handler_ptr handler
+		listener_ptr listener
 	)
 	{
 		using boost::make_shared;
+		auto& handler = listener->handler;
+
+		// replies are small and sent one by one, so don't let Nagle hold them back
+		boost::system::error_code ec;
+		socket->set_option(boost::asio::ip::tcp::no_delay(true), ec);
+
+		std::shared_ptr<connection_metrics> metrics;
+		if (metrics_enabled && listener->options.metrics)
+		{
+			auto endpoint = socket->remote_endpoint(ec);
+			metrics = listener->options.metrics->add_connection(
+				endpoint.address().to_string(ec) + ":" + std::to_string(endpoint.port())
+			);
+		}
 
 		// construct the output_protocol and call the handler
-		auto t1 = boost::make_shared<thrift_asio_transport>(socket, handler.get());
-		boost::shared_ptr<apache::thrift::transport::TTransport> t2
-			= boost::make_shared<TFramedTransport>(t1);
-		if (use_compression)
-			t2 = boost::make_shared<TZlibTransport>(t2, 128, 1024, 128, 1024, 9);
-		auto output_protocol = boost::make_shared<TBinaryProtocol>(t2);
-		handler->on_client_connected(output_protocol);
+		auto t1 = boost::make_shared<thrift_asio_transport>(
+			socket, handler.get(), listener->options.receive_buffer, listener->options.outbound_queue
+		);
+		t1->set_metrics(metrics);
+
+		uint64_t trace_connection_id = 0;
+		if (tracing_enabled && listener->options.tracer)
+		{
+			trace_connection_id = listener->options.tracer->new_connection_id();
+			t1->set_tracer(listener->options.tracer, trace_connection_id);
+		}
+		auto output_protocol = boost::make_shared<output_protocol_type>(
+			boost::make_shared<thrift_asio_framed_transport>(t1, listener->options.compression)
+		);
+		auto handler_protocol = make_handler_protocol(output_protocol, uses_legacy_protocol());
+		auto context = client_connected(*handler, handler_protocol, has_connection_context());
+
+		auto s = std::make_shared<session>(
+			io_service, socket, listener, t1, output_protocol, handler_protocol, std::move(context)
+		);
+		s->metrics = std::move(metrics);
+		s->trace_connection_id = trace_connection_id;
 
-		read_frame_size(io_service, socket, output_protocol, processor, handler);
+		// everything, that happens on this connection, is serialized by the strand
+		s->strand.dispatch([s]{ read_frames(s); });
 	}
 
-	// read the size of a frame. Clients are expected to use the framed protocol
-	static void read_frame_size(
-		boost::asio::io_service& io_service,
-		std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-		boost::shared_ptr<TBinaryProtocol> output_protocol,
-		TProcessor& processor,
-		Handler_ptr handler
+	// called once per connection, when it is gone
+	static void on_disconnected(const session_ptr& session, const boost::system::error_code& ec)
+	{
+		client_disconnected(*session->listener->handler, *session, ec, has_connection_context());
+		if (session->metrics)
+			session->listener->options.metrics->remove_connection(session->metrics);
+		on_connection_closed(session->listener);
+	}
+
+	static boost::shared_ptr<output_protocol_type> make_handler_protocol(
+		const boost::shared_ptr<output_protocol_type>& output_protocol, std::false_type
+	)
+	{
+		return output_protocol;
+	}
+
+	static boost::shared_ptr<legacy_protocol_type> make_handler_protocol(
+		const boost::shared_ptr<output_protocol_type>& output_protocol, std::true_type
 	)
 	{
-		auto frame_size = std::make_shared<uint32_t>(0);
-		boost::asio::async_read(
-			*socket, boost::asio::buffer(frame_size.get(), sizeof(uint32_t)),
-			[&io_service, socket, output_protocol, &processor, handler, frame_size]
-				(const boost::system::error_code& ec, std::size_t /*bytes_transferred*/)
+		return boost::make_shared<legacy_protocol_type>(output_protocol->getTransport());
+	}
+
+	// the following overloads call the handler with or without the connection context
+	static connection_context client_connected(HandlerType& handler, const protocol_ptr& output_protocol, std::true_type)
+	{
+		return handler.on_client_connected(output_protocol);
+	}
+
+	static connection_context client_connected(HandlerType& handler, const protocol_ptr& output_protocol, std::false_type)
+	{
+		handler.on_client_connected(output_protocol);
+		return nullptr;
+	}
+
+	static void client_disconnected(HandlerType& handler, session& s, const boost::system::error_code& ec, std::true_type)
+	{
+		handler.on_client_disconnected(s.handler_protocol, ec, s.context);
+	}
+
+	static void client_disconnected(HandlerType& handler, session& s, const boost::system::error_code& ec, std::false_type)
+	{
+		handler.on_client_disconnected(s.handler_protocol, ec);
+	}
+
+	static void before_process(HandlerType& handler, session& s, std::true_type)
+	{
+		handler.before_process(s.handler_protocol, s.context);
+	}
+
+	static void before_process(HandlerType& handler, session& s, std::false_type)
+	{
+		handler.before_process(s.handler_protocol);
+	}
+
+	// read as many bytes as are available. Clients are expected to use the framed protocol
+	static void read_frames(session_ptr session)
+	{
+		auto& buffer = session->incomming_bytes;
+		buffer.reserve(std::max(session->transport->receive_buffer_size(), session->missing_bytes));
+
+		session->socket->async_read_some(
+			buffer.prepare(buffer.free_space()),
+			session->strand.wrap([session]
+				(const boost::system::error_code& ec, std::size_t bytes_transferred)
 			{
 				if(ec)
 				{
-					std::clog << ec.message() << std::endl;
-					handler->on_client_disconnected(output_protocol, ec);
+					THRIFT_ASIO_LOG(log_level::info, "client disconnected", {{"error", ec}});
+					on_disconnected(session, ec);
 				}
 				else
 				{
-					*frame_size = ntohl(*frame_size);
-					read_frame_data(io_service, socket, output_protocol, processor, handler, *frame_size);
+					session->incomming_bytes.commit(bytes_transferred);
+					if (metrics_enabled && session->metrics)
+						session->metrics->bytes_in.fetch_add(bytes_transferred, std::memory_order_relaxed);
+					if (tracing_enabled && session->listener->options.tracer)
+						session->received_at = tracer::clock::now();
+					if (process_frames(session))
+					{
+						session->transport->count_receive(bytes_transferred);
+
+						// read the next frames
+						continue_reading(session);
+					}
 				}
-			}
+			})
 		);
 	}
 
-	// read the data of the frame
-	static void read_frame_data(
-		boost::asio::io_service& io_service,
-		std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-		boost::shared_ptr<TBinaryProtocol> output_protocol,
-		TProcessor& processor,
-		Handler_ptr handler,
-		uint32_t frame_size
-	)
+	// read the next frames, unless too much output is waiting to be sent to the client
+	static void continue_reading(const session_ptr& session)
 	{
-		auto frame_bytes = std::make_shared<std::vector<uint8_t>>(frame_size);
-		boost::asio::async_read(
-			*socket, boost::asio::buffer(frame_bytes->data(), frame_size),
-			[&io_service, socket, output_protocol, &processor, handler, frame_bytes]
-				(const boost::system::error_code& ec, std::size_t /*bytes_transferred*/)
+		auto high_water_mark = session->listener->options.outbound_high_water_mark;
+		if (high_water_mark != 0 && session->transport->outbound_bytes() > high_water_mark)
+		{
+			// the client does not keep up with the responses, stop reading until it does
+			session->transport->async_wait_for_drain(high_water_mark / 2, [session]
 			{
-				if(ec)
+				read_frames(session);
+			});
+		}
+		else
+		{
+			read_frames(session);
+		}
+	}
+
+	// process all complete frames in the receive buffer.
+	// returns false, if the connection was closed or is paused
+	static bool process_frames(const session_ptr& session)
+	{
+		auto& buffer = session->incomming_bytes;
+		auto max_frame_size = session->listener->options.max_frame_size;
+
+		auto max_pending_requests = session->listener->options.max_pending_requests;
+		auto workers = session->listener->processor ? session->listener->options.workers.get() : nullptr;
+
+		while (buffer.size() >= sizeof(uint32_t))
+		{
+			if (max_pending_requests != 0 && session->pending_requests >= max_pending_requests)
+			{
+				// resumed by complete_request
+				session->is_paused = true;
+				return false;
+			}
+
+			if (workers && !workers->has_capacity())
+			{
+				session->is_paused = true;
+				workers->async_wait_for_capacity([session]
+				{
+					session->strand.dispatch([session]{ resume(session); });
+				});
+				return false;
+			}
+
+			uint32_t frame_size = 0;
+			buffer.peek(reinterpret_cast<uint8_t*>(&frame_size), sizeof(uint32_t));
+			frame_size = ntohl(frame_size);
+
+			const bool is_compressed = (frame_size & frame_codec::compressed_flag) != 0;
+			frame_size &= ~frame_codec::compressed_flag;
+
+			if (max_frame_size != 0 && frame_size > max_frame_size)
+			{
+				// reject it, before any memory is allocated for it
+				THRIFT_ASIO_LOG(log_level::warning, "frame exceeds max_frame_size",
+					{{"frame_size", frame_size}, {"max_frame_size", max_frame_size}});
+				session->transport->close();
+				on_disconnected(session, boost::asio::error::message_size);
+				return false;
+			}
+
+			if (buffer.size() - sizeof(uint32_t) < frame_size)
+			{
+				session->missing_bytes = sizeof(uint32_t) + frame_size - buffer.size();
+				mark_partial_frame(*session);
+				return true;
+			}
+
+			buffer.consume(sizeof(uint32_t));
+
+			size_t contiguous_bytes = 0;
+			uint8_t* frame_data = buffer.data(&contiguous_bytes);
+			if (contiguous_bytes < frame_size)
+			{
+				// the frame wraps around, copy it into one piece
+				if (session->frame_bytes.size() < frame_size)
+					session->frame_bytes.resize(frame_size);
+				buffer.peek(session->frame_bytes.data(), frame_size);
+				frame_data = session->frame_bytes.data();
+			}
+
+			uint8_t* payload = frame_data;
+			uint32_t payload_size = frame_size;
+			if (is_compressed)
+			{
+				try
 				{
-					std::clog << ec.message() << std::endl;
-					handler->on_client_disconnected(output_protocol, ec);
+					session->codec.decompress_frame(frame_data, frame_size, session->decompressed_bytes, max_frame_size);
 				}
-				else
+				catch (const apache::thrift::transport::TTransportException& e)
 				{
-					boost::shared_ptr<apache::thrift::transport::TTransport> input_transport
-						= boost::make_shared<TMemoryBuffer>(frame_bytes->data(), frame_bytes->size());
-					//if(use_compression)
-					//	input_transport = boost::make_shared<TZlibTransport>(input_transport);
-					auto input_protocol = boost::make_shared<TBinaryProtocol>(input_transport);
+					THRIFT_ASIO_LOG(log_level::warning, "invalid compressed frame", {{"error", e.what()}});
+					session->transport->close();
+					on_disconnected(session, boost::asio::error::invalid_argument);
+					return false;
+				}
+				payload = session->decompressed_bytes.data();
+				payload_size = uint32_t(session->decompressed_bytes.size());
+			}
 
-					void* connection_context = nullptr;
+			process_frame(session, payload, payload_size, trace_frame(*session, frame_size));
+			buffer.consume(frame_size);
+		}
 
-					handler->before_process(output_protocol);
-					processor.process(input_protocol, output_protocol, connection_context);
-					handler->after_process();
+		session->missing_bytes = 0;
+		if (!buffer.empty())
+			mark_partial_frame(*session);
+		return true;
+	}
 
-					// read the next frame
-					read_frame_size(io_service, socket, output_protocol, processor, handler);
-				}
+	// remembers, when the first bytes of the frame, that is not complete yet, were received
+	static void mark_partial_frame(session& s)
+	{
+		if (tracing_enabled && !s.has_partial_frame)
+		{
+			s.has_partial_frame = true;
+			s.frame_started_at = s.received_at;
+		}
+	}
+
+	// decides, whether the frame, that was just received, is traced.
+	// returns its request id, or 0.
+	static uint64_t trace_frame(session& s, uint32_t frame_size)
+	{
+		auto& tracer = s.listener->options.tracer;
+		if (!tracing_enabled || !tracer)
+			return 0;
+
+		auto started_at = s.has_partial_frame ? s.frame_started_at : s.received_at;
+		s.has_partial_frame = false;
+
+		uint64_t request_id = tracer->start_request();
+		if (request_id != 0)
+		{
+			tracer->record(trace_event::frame_started, started_at, s.trace_connection_id, request_id, frame_size);
+			tracer->record(trace_event::frame_received, s.received_at, s.trace_connection_id, request_id, frame_size);
+		}
+		return request_id;
+	}
+
+	// records an event of a traced request
+	static void trace(const session& s, trace_event event, uint64_t request_id, uint32_t frame_size)
+	{
+		if (tracing_enabled && request_id != 0)
+			s.listener->options.tracer->record(event, s.trace_connection_id, request_id, frame_size);
+	}
+
+	// process the data of one frame
+	static void process_frame(const session_ptr& session, uint8_t* frame_data, uint32_t frame_size, uint64_t request_id)
+	{
+		auto& handler = session->listener->handler;
+		auto& options = session->listener->options;
+		session->input_transport->resetBuffer(frame_data, frame_size);
+
+		metrics_registry* metrics = nullptr;
+		std::string method_name;
+		const bool filter_offload = session->listener->processor && options.workers && options.offload;
+		if ((metrics_enabled && session->metrics) || filter_offload)
+			method_name = read_method_name(session, frame_data, frame_size);
+		if (metrics_enabled && session->metrics)
+		{
+			session->metrics->frames_in.fetch_add(1, std::memory_order_relaxed);
+			metrics = options.metrics.get();
+		}
+
+		if (session->listener->processor && should_offload(session, method_name))
+		{
+			offload_frame(session, frame_data, frame_size, metrics, std::move(method_name), request_id);
+			return;
+		}
+
+		void* call_context = nullptr;
+
+		before_process(*handler, *session, has_connection_context());
+		trace(*session, trace_event::dispatch_begin, request_id, frame_size);
+		if (session->listener->processor)
+		{
+			call_metrics call(metrics, std::move(method_name));
+			bool success = false;
+			{
+				tracer::request_scope scope(session->listener->options.tracer.get(), request_id);
+				typename call_acceptance::scope acceptance(metrics ? &call.is_accepted : nullptr);
+				success = session->listener->processor->process(
+					session->input_protocol, session->output_protocol, call_context
+				);
 			}
-		);
+			call.record(success);
+			trace(*session, trace_event::dispatch_end, request_id, frame_size);
+		}
+		else
+		{
+			// the arguments are read right away, the reply is written, when the handler completes
+			auto reply_buffer = boost::make_shared<TMemoryBuffer>();
+			auto call = std::make_shared<call_metrics>(metrics, std::move(method_name));
+			typename call_acceptance::scope acceptance(metrics ? &call->is_accepted : nullptr);
+			++session->pending_requests;
+			session->listener->async_processor->process(
+				[session, reply_buffer, call, request_id, frame_size](bool success)
+				{
+					call->record(success);
+					trace(*session, trace_event::dispatch_end, request_id, frame_size);
+
+					session->strand.dispatch([session, reply_buffer, success, request_id]
+					{
+						complete_request(session, *reply_buffer, success, request_id);
+					});
+				},
+				session->input_protocol,
+				boost::make_shared<reply_protocol_type>(reply_buffer)
+			);
+		}
+		handler->after_process();
+	}
+
+	// the name of the method, that the current frame calls. Leaves the frame unread.
+	static std::string read_method_name(const session_ptr& session, uint8_t* frame_data, uint32_t frame_size)
+	{
+		std::string method;
+		apache::thrift::protocol::TMessageType type;
+		int32_t seqid = 0;
+		session->input_protocol->readMessageBegin(method, type, seqid);
+		session->input_transport->resetBuffer(frame_data, frame_size); // rewind
+		return method;
+	}
+
+	// true, if the current frame is to be processed by the workers
+	static bool should_offload(const session_ptr& session, const std::string& method)
+	{
+		auto& options = session->listener->options;
+		if (!options.workers)
+			return false;
+		if (!options.offload)
+			return true;
+
+		return options.offload(method);
+	}
+
+	// copies the frame and processes it on a worker
+	static void offload_frame(
+		const session_ptr& session, const uint8_t* frame_data, uint32_t frame_size,
+		metrics_registry* metrics, std::string method_name, uint64_t request_id
+	)
+	{
+		auto frame = std::make_shared<std::vector<uint8_t>>(frame_data, frame_data + frame_size);
+		auto call = std::make_shared<call_metrics>(metrics, std::move(method_name));
+
+		// like for asynchronous handlers, before_process and after_process are called around
+		// handing the frame over. The worker only writes to its own reply_buffer.
+		auto& handler = *session->listener->handler;
+		before_process(handler, *session, has_connection_context());
+		++session->pending_requests;
+		session->listener->options.workers->post([session, frame, call, request_id, frame_size]
+		{
+			auto input_transport = boost::make_shared<TMemoryBuffer>(frame->data(), uint32_t(frame->size()));
+			auto reply_buffer = boost::make_shared<TMemoryBuffer>();
+
+			bool success = true;
+			trace(*session, trace_event::dispatch_begin, request_id, frame_size);
+			try
+			{
+				typename call_acceptance::scope acceptance(call->registry ? &call->is_accepted : nullptr);
+				success = session->listener->processor->process(
+					boost::make_shared<input_protocol_type>(input_transport),
+					boost::make_shared<reply_protocol_type>(reply_buffer),
+					nullptr
+				);
+			}
+			catch (const std::exception& e)
+			{
+				THRIFT_ASIO_LOG(log_level::error, "request failed on worker", {{"error", e.what()}});
+				success = false;
+			}
+			call->record(success);
+			trace(*session, trace_event::dispatch_end, request_id, frame_size);
+
+			session->strand.dispatch([session, reply_buffer, success, request_id]
+			{
+				complete_request(session, *reply_buffer, success, request_id);
+			});
+		});
+		handler.after_process();
+	}
+
+	// processes the frames, that were received while the session was paused, and reads more
+	static void resume(const session_ptr& session)
+	{
+		if (!session->is_paused)
+			return;
+
+		session->is_paused = false;
+		if (process_frames(session))
+			continue_reading(session);
+	}
+
+	// sends the reply of an asynchronous handler and resumes processing frames, if it was paused
+	static void complete_request(const session_ptr& session, TMemoryBuffer& reply_buffer, bool success, uint64_t request_id)
+	{
+		assert(session->pending_requests > 0);
+		--session->pending_requests;
+
+		if (!success)
+			THRIFT_ASIO_LOG(log_level::warning, "request failed");
+
+		if (!session->transport->isOpen())
+		{
+			// no read is pending, that would report the disconnect
+			if (session->is_paused)
+			{
+				session->is_paused = false;
+				on_disconnected(session, boost::asio::error::not_connected);
+			}
+			return;
+		}
+
+		uint8_t* reply = nullptr;
+		uint32_t reply_size = 0;
+		reply_buffer.getBuffer(&reply, &reply_size);
+		if (reply_size != 0) // oneway calls have no reply
+		{
+			tracer::request_scope scope(session->listener->options.tracer.get(), request_id);
+			auto output_transport = session->output_protocol->getTransport();
+			output_transport->write(reply, reply_size);
+			output_transport->flush();
+		}
+
+		resume(session);
 	}
 };
 
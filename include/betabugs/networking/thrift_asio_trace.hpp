@@ -0,0 +1,355 @@
+#ifndef _THRIFT_ASIO_TRACE_HPP_
+#define _THRIFT_ASIO_TRACE_HPP_
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace betabugs {
+namespace networking {
+
+/// false, if THRIFT_ASIO_NO_TRACING is defined. Nothing is traced then, even if a tracer is set.
+#ifdef THRIFT_ASIO_NO_TRACING
+constexpr bool tracing_enabled = false;
+#else
+constexpr bool tracing_enabled = true;
+#endif
+
+/// the points in the life of a request, that are traced
+enum class trace_event : uint32_t
+{
+	frame_started,   ///< the first bytes of the frame were received
+	frame_received,  ///< the frame is complete
+	dispatch_begin,  ///< the processor is called
+	dispatch_end,    ///< the processor returned, or the asynchronous handler completed
+	write_queued,    ///< a frame was written to the outbound queue of the transport
+	write_completed  ///< that frame was sent
+};
+
+inline const char* to_string(trace_event event)
+{
+	switch (event)
+	{
+		case trace_event::frame_started: return "frame_started";
+		case trace_event::frame_received: return "frame_received";
+		case trace_event::dispatch_begin: return "dispatch_begin";
+		case trace_event::dispatch_end: return "dispatch_end";
+		case trace_event::write_queued: return "write_queued";
+		case trace_event::write_completed: return "write_completed";
+	}
+	return "unknown";
+}
+
+struct trace_record
+{
+	uint64_t timestamp_ns; ///< of std::chrono::steady_clock
+	uint64_t connection_id;
+	uint64_t request_id;   ///< the frame, that the event belongs to
+	trace_event event;
+	uint32_t bytes;        ///< the size of the frame
+};
+
+/// receives the events of sampled requests. Called from the io_service and worker threads.
+class trace_sink
+{
+  public:
+	virtual ~trace_sink() {}
+	virtual void record(const trace_record& r) = 0;
+};
+
+/*!
+* A trace_sink, that keeps the last capacity records in memory, like a flight recorder.
+* Recording is lock-free and wait-free, older records are overwritten.
+*
+* @code
+* auto buffer = std::make_shared<trace_buffer>(1 << 16);
+* options.tracer = std::make_shared<tracer>(buffer, 100); // trace every 100th request
+* ...
+* std::ofstream out("trace.json");
+* buffer->write_chrome_trace(out); // open in chrome://tracing or ui.perfetto.dev
+* @endcode
+* */
+class trace_buffer : public trace_sink
+{
+  public:
+	/// @param capacity rounded up to a power of two
+	explicit trace_buffer(size_t capacity = 1 << 16)
+		: capacity_(round_up_to_power_of_two(capacity))
+		, slots_(new slot[capacity_])
+		, next_(0)
+	{
+		for (size_t i = 0; i < capacity_; ++i)
+			slots_[i].sequence.store(0, std::memory_order_relaxed);
+	}
+
+	virtual void record(const trace_record& r) override
+	{
+		uint64_t position = next_.fetch_add(1, std::memory_order_relaxed);
+		auto& s = slots_[position & (capacity_ - 1)];
+
+		// a seqlock: odd while the slot is written
+		s.sequence.store(2 * position + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		s.timestamp_ns.store(r.timestamp_ns, std::memory_order_relaxed);
+		s.connection_id.store(r.connection_id, std::memory_order_relaxed);
+		s.request_id.store(r.request_id, std::memory_order_relaxed);
+		s.event_and_bytes.store((uint64_t(r.event) << 32) | r.bytes, std::memory_order_relaxed);
+		s.sequence.store(2 * position + 2, std::memory_order_release);
+	}
+
+	/// the records, that are in the buffer, in the order they were recorded
+	std::vector<trace_record> records() const
+	{
+		std::vector<std::pair<uint64_t, trace_record>> sequenced;
+		sequenced.reserve(capacity_);
+		for (size_t i = 0; i < capacity_; ++i)
+		{
+			auto& s = slots_[i];
+			auto sequence = s.sequence.load(std::memory_order_acquire);
+			if (sequence == 0 || sequence % 2 != 0)
+				continue;
+
+			trace_record r;
+			r.timestamp_ns = s.timestamp_ns.load(std::memory_order_relaxed);
+			r.connection_id = s.connection_id.load(std::memory_order_relaxed);
+			r.request_id = s.request_id.load(std::memory_order_relaxed);
+			auto event_and_bytes = s.event_and_bytes.load(std::memory_order_relaxed);
+			r.event = trace_event(event_and_bytes >> 32);
+			r.bytes = uint32_t(event_and_bytes);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (s.sequence.load(std::memory_order_relaxed) != sequence)
+				continue; // overwritten while it was read
+
+			sequenced.emplace_back(sequence, r);
+		}
+
+		std::sort(sequenced.begin(), sequenced.end(), [](const std::pair<uint64_t, trace_record>& a, const std::pair<uint64_t, trace_record>& b)
+		{
+			return a.first < b.first;
+		});
+
+		std::vector<trace_record> result;
+		result.reserve(sequenced.size());
+		for (auto& x : sequenced)
+			result.push_back(x.second);
+		return result;
+	}
+
+	/// writes records() in the Chrome trace event format, see write_chrome_trace(std::ostream&, const std::vector<trace_record>&)
+	void write_chrome_trace(std::ostream& out) const;
+
+  private:
+	struct slot
+	{
+		std::atomic<uint64_t> sequence; ///< 0, if empty
+		std::atomic<uint64_t> timestamp_ns;
+		std::atomic<uint64_t> connection_id;
+		std::atomic<uint64_t> request_id;
+		std::atomic<uint64_t> event_and_bytes;
+	};
+
+	const size_t capacity_;
+	std::unique_ptr<slot[]> slots_;
+	std::atomic<uint64_t> next_;
+
+	static size_t round_up_to_power_of_two(size_t n)
+	{
+		size_t result = 1;
+		while (result < n)
+			result *= 2;
+		return result;
+	}
+};
+
+/// writes records in the Chrome trace event format (JSON)
+/*!
+* The events of a request are paired into spans: "receive" (frame_started to frame_received),
+* "queue" (frame_received to dispatch_begin), "process" (dispatch_begin to dispatch_end)
+* and "send" (write_queued to write_completed). The thread of a span is its connection.
+* Events, whose partner is not in records, are left out.
+* */
+inline void write_chrome_trace(std::ostream& out, const std::vector<trace_record>& records)
+{
+	struct pending_request
+	{
+		const trace_record* started = nullptr;
+		const trace_record* received = nullptr;
+		const trace_record* dispatched = nullptr;
+		std::deque<const trace_record*> queued_writes;
+	};
+	std::map<uint64_t, pending_request> requests;
+
+	bool is_first = true;
+	auto write_span = [&](const char* name, const trace_record& begin, const trace_record& end)
+	{
+		out << (is_first ? "\n" : ",\n")
+			<< "{\"name\":\"" << name << "\",\"cat\":\"thrift_asio\",\"ph\":\"X\""
+			<< ",\"ts\":" << double(begin.timestamp_ns) / 1000
+			<< ",\"dur\":" << double(end.timestamp_ns - begin.timestamp_ns) / 1000
+			<< ",\"pid\":1,\"tid\":" << begin.connection_id
+			<< ",\"args\":{\"request\":" << begin.request_id << ",\"bytes\":" << begin.bytes << "}}";
+		is_first = false;
+	};
+
+	out << "{\"traceEvents\":[";
+	for (auto& r : records)
+	{
+		auto& request = requests[r.request_id];
+		switch (r.event)
+		{
+			case trace_event::frame_started:
+				request.started = &r;
+				break;
+			case trace_event::frame_received:
+				if (request.started)
+					write_span("receive", *request.started, r);
+				request.received = &r;
+				break;
+			case trace_event::dispatch_begin:
+				if (request.received)
+					write_span("queue", *request.received, r);
+				request.dispatched = &r;
+				break;
+			case trace_event::dispatch_end:
+				if (request.dispatched)
+					write_span("process", *request.dispatched, r);
+				break;
+			case trace_event::write_queued:
+				request.queued_writes.push_back(&r);
+				break;
+			case trace_event::write_completed:
+				if (!request.queued_writes.empty())
+				{
+					write_span("send", *request.queued_writes.front(), r);
+					request.queued_writes.pop_front();
+				}
+				break;
+		}
+	}
+	out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+inline void trace_buffer::write_chrome_trace(std::ostream& out) const
+{
+	networking::write_chrome_trace(out, records());
+}
+
+/*!
+* Decides, which requests are traced, and passes their events to a trace_sink.
+* Set it as server_options::tracer.
+*
+* Every sample_every-th frame is traced, the others cost one atomic increment.
+* */
+class tracer
+{
+  public:
+	explicit tracer(std::shared_ptr<trace_sink> sink, uint32_t sample_every = 1)
+		: sink_(std::move(sink))
+		, sample_every_(std::max<uint32_t>(sample_every, 1))
+		, next_request_id_(0)
+		, next_connection_id_(1)
+	{
+	}
+
+	typedef std::chrono::steady_clock clock;
+
+	/// the id of a new request, or 0, if it is not sampled
+	uint64_t start_request()
+	{
+		uint64_t id = next_request_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+		return id % sample_every_ == 0 ? id : 0;
+	}
+
+	uint64_t new_connection_id()
+	{
+		return next_connection_id_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void record(trace_event event, clock::time_point time, uint64_t connection_id, uint64_t request_id, size_t bytes)
+	{
+		trace_record r;
+		r.timestamp_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+		r.connection_id = connection_id;
+		r.request_id = request_id;
+		r.event = event;
+		r.bytes = uint32_t(bytes);
+		sink_->record(r);
+	}
+
+	void record(trace_event event, uint64_t connection_id, uint64_t request_id, size_t bytes)
+	{
+		record(event, clock::now(), connection_id, request_id, bytes);
+	}
+
+	/// the request of this tracer, that the current thread is processing, or 0.
+	/*!
+	* Set by thrift_asio_server around the processor, so that thrift_asio_transport can
+	* attribute the frames written meanwhile to the request. Requests of other tracers,
+	* i.e. of another server, that writes to this server's connections, are not returned.
+	* */
+	uint64_t current_request() const
+	{
+		auto& current = current_scope();
+		return current.owner == this ? current.request_id : 0;
+	}
+
+	/// sets current_request() of owner for the lifetime of the scope
+	class request_scope
+	{
+	  public:
+		/// @param owner the tracer, that started the request. Nothing is set, if it is null.
+		request_scope(const tracer* owner, uint64_t request_id)
+			: previous_owner_(current_scope().owner)
+			, previous_request_id_(current_scope().request_id)
+		{
+			current_scope().owner = owner;
+			current_scope().request_id = request_id;
+		}
+
+		~request_scope()
+		{
+			current_scope().owner = previous_owner_;
+			current_scope().request_id = previous_request_id_;
+		}
+
+		request_scope(const request_scope&) = delete;
+		request_scope& operator=(const request_scope&) = delete;
+
+	  private:
+		const tracer* previous_owner_;
+		uint64_t previous_request_id_;
+	};
+
+  private:
+	struct scope_state
+	{
+		const tracer* owner;
+		uint64_t request_id;
+	};
+
+	static scope_state& current_scope()
+	{
+		static thread_local scope_state state = { nullptr, 0 };
+		return state;
+	}
+
+	std::shared_ptr<trace_sink> sink_;
+	const uint32_t sample_every_;
+	std::atomic<uint64_t> next_request_id_;
+	std::atomic<uint64_t> next_connection_id_;
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_TRACE_HPP_
@@ -10,10 +10,20 @@
 #include <thrift/transport/TVirtualTransport.h>
 //#include <boost/asio.hpp>
 #include <boost/smart_ptr/enable_shared_from_this.hpp>
+#include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/make_shared.hpp>
-#include <deque>
+#include <thrift/transport/TTransportException.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <vector>
+#include "./ring_buffer.hpp"
+#include "./thrift_asio_metrics.hpp"
+#include "./thrift_asio_trace.hpp"
 
 namespace betabugs {
 namespace networking {
@@ -28,9 +38,18 @@ class thrift_asio_transport
     : public apache::thrift::transport::TVirtualTransport<thrift_asio_transport>
     , public boost::enable_shared_from_this<thrift_asio_transport>
 {
-	static constexpr size_t BUFFER_SIZE = 1024;
-
   public:
+	/// counters describing the outbound queue of a transport
+	struct outbound_statistics
+	{
+		size_t queued_bytes = 0;        ///< bytes written, but not yet sent
+		size_t queued_messages = 0;     ///< messages written, but not yet sent
+		size_t peak_queued_bytes = 0;   ///< the maximum of queued_bytes so far
+		uint64_t overflow_count = 0;    ///< how often a write exceeded the limits
+		uint64_t dropped_messages = 0;  ///< messages discarded by drop_oldest/drop_newest
+		uint64_t dropped_bytes = 0;     ///< bytes discarded by drop_oldest/drop_newest
+	};
+
 	/*!
 	* Interface for handling transport events
 	* */
@@ -53,16 +72,179 @@ class thrift_asio_transport
 		virtual void on_disconnected()
 		{
 		}
+
+		/// Gets invoked, when a write exceeds the outbound queue limits and
+		/// the overflow_policy is notify. May be called from any thread, that writes.
+		virtual void on_backpressure(const outbound_statistics& stats)
+		{
+			(void) stats;
+		}
+	};
+
+	/*!
+	* Controls how many bytes are received from the socket at once.
+	*
+	* Bigger chunks mean fewer async_receive completions per frame, smaller
+	* chunks mean less memory per connection. In adaptive mode, the chunk size
+	* is doubled, whenever grow_after consecutive receives filled the chunk
+	* completely, and halved (releasing memory) after shrink_after consecutive
+	* receives, that used less than a quarter of it.
+	* */
+	struct receive_buffer_options
+	{
+		receive_buffer_options()
+			: initial_size(1024)
+			, min_size(1024)
+			, max_size(64 * 1024)
+			, adaptive(false)
+			, grow_after(2)
+			, shrink_after(16)
+		{
+		}
+
+		size_t initial_size;   ///< chunk size to start with
+		size_t min_size;       ///< lower bound in adaptive mode
+		size_t max_size;       ///< upper bound in adaptive mode
+		bool adaptive;         ///< if false, initial_size is used all the time
+		unsigned grow_after;   ///< number of full receives before growing
+		unsigned shrink_after; ///< number of small receives before shrinking
 	};
 
+	/*!
+	* The chunk size of adaptive receive_buffer_options. Used by thrift_asio_transport
+	* and by the connections of thrift_asio_server, so that both adapt the same way.
+	* */
+	class receive_buffer_sizer
+	{
+	  public:
+		explicit receive_buffer_sizer(const receive_buffer_options& options)
+			: options_(options)
+			, size_(options.initial_size)
+		{
+			assert(options.initial_size > 0);
+			assert(!options.adaptive || options.min_size <= options.initial_size);
+			assert(!options.adaptive || options.initial_size <= options.max_size);
+		}
+
+		/// the number of bytes to receive at once
+		size_t size() const
+		{
+			return size_;
+		}
+
+		/// adapts size() to a receive of n bytes
+		/*!
+		* @returns true, if size() was decreased, so that the receive buffer can release memory
+		* */
+		bool on_receive(size_t n)
+		{
+			if (!options_.adaptive)
+				return false;
+
+			// grow the chunk size for busy connections, shrink it for idle ones
+			if (n >= size_)
+			{
+				small_receives_ = 0;
+				if (++full_receives_ >= options_.grow_after && size_ < options_.max_size)
+				{
+					full_receives_ = 0;
+					size_ = std::min(size_ * 2, options_.max_size);
+					++grow_count_;
+				}
+			}
+			else if (n < size_ / 4)
+			{
+				full_receives_ = 0;
+				if (++small_receives_ >= options_.shrink_after && size_ > options_.min_size)
+				{
+					small_receives_ = 0;
+					size_ = std::max(size_ / 2, options_.min_size);
+					++shrink_count_;
+					return true;
+				}
+			}
+			else
+			{
+				full_receives_ = 0;
+				small_receives_ = 0;
+			}
+			return false;
+		}
+
+		uint64_t grow_count() const { return grow_count_; }
+		uint64_t shrink_count() const { return shrink_count_; }
+
+	  private:
+		receive_buffer_options options_;
+		size_t size_;
+		unsigned full_receives_ = 0;
+		unsigned small_receives_ = 0;
+		uint64_t grow_count_ = 0;
+		uint64_t shrink_count_ = 0;
+	};
+
+	/// counters describing the receive side of a transport
+	struct receive_statistics
+	{
+		size_t buffer_size = 0;       ///< the chunk size currently in use
+		size_t buffer_capacity = 0;   ///< bytes allocated for the receive buffer
+		uint64_t receive_count = 0;   ///< number of completed receives
+		uint64_t bytes_received = 0;  ///< total number of bytes received
+		uint64_t grow_count = 0;      ///< how often the chunk size was increased
+		uint64_t shrink_count = 0;    ///< how often the chunk size was decreased
+	};
+
+	/// what happens to a write, that exceeds the outbound_queue_options
+	enum class overflow_policy
+	{
+		drop_oldest, ///< discard queued messages, that are not being sent yet, to make room
+		drop_newest, ///< discard the message, that is being written
+		disconnect,  ///< close the transport (reported as no_buffer_space to on_error)
+		notify       ///< queue the message anyway and invoke event_handlers::on_backpressure
+	};
+
+	/*!
+	* Bounds the number of bytes and messages, that wait to be sent.
+	*
+	* Without a bound, a client, that does not read, makes the queue grow without limit.
+	* A message is what is passed to a single write() call, i.e. a whole frame when
+	* writing through TFramedTransport. Messages, that are already being sent, are never
+	* dropped, so the limits are approximate by up to one gathering write.
+	* */
+	struct outbound_queue_options
+	{
+		outbound_queue_options()
+			: max_bytes(0)
+			, max_messages(0)
+			, policy(overflow_policy::notify)
+		{
+		}
+
+		size_t max_bytes;      ///< zero means unbounded
+		size_t max_messages;   ///< zero means unbounded
+		overflow_policy policy;
+	};
+
+	/// an immutable, reference counted chunk of outbound bytes
+	typedef std::shared_ptr<const std::vector<uint8_t>> shared_buffer;
+
 	/// a shared_ptr to a tcp socket
 	typedef std::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
     typedef std::weak_ptr<boost::asio::ip::tcp::socket> socket_weak_ptr;
 
     /// creates a thrift_asio_transport from a socket_ptr
-	thrift_asio_transport(socket_ptr socket, event_handlers* event_handlers)
+	thrift_asio_transport(
+		socket_ptr socket,
+		event_handlers* event_handlers,
+		const receive_buffer_options& options = receive_buffer_options(),
+		const outbound_queue_options& outbound_options = outbound_queue_options()
+	)
 		: socket_(socket)
 		, event_handlers_(event_handlers)
+		, strand_(socket->get_io_service())
+		, receive_sizer_(options)
+		, incomming_bytes_(4 * options.initial_size)
+		, outbound_options_(outbound_options)
 	{
 		assert(event_handlers);
 	};
@@ -76,8 +258,11 @@ class thrift_asio_transport
 	/*!
 	*
 	* This does not block if data is available. But it does block,
-	* if there is not enough data. If you don't want to block, use
-	* available_bytes() to check if there's enough data.
+	* if there is not enough data, by running the io_service until it
+	* arrived. That runs arbitrary handlers from within the caller.
+	* If you don't want to block, use available_bytes() to check if
+	* there's enough data (thrift_asio_client::update() only dispatches
+	* frames, that were received completely, so it never gets here).
 	*
 	* @param buf  Reference to the location to write the data
 	* @param len  How many bytes to read
@@ -90,16 +275,44 @@ class thrift_asio_transport
 			socket_->get_io_service().run_one();
 		}
 
-		auto bytes_to_copy = std::min<size_t>(len, incomming_bytes_.size());
+		return uint32_t(incomming_bytes_.read(buf, len));
+	}
+
+	/// Attempt to return a pointer to len bytes, without copying them.
+	/*!
+	* This never blocks. If len bytes are not available in one contiguous
+	* span of the receive buffer, nullptr is returned and the caller is
+	* expected to fall back to read().
+	*
+	* @param buf  unused, the data is never copied
+	* @param len  the number of bytes requested. On success, it is set
+	*             to the number of contiguous bytes available.
+	* @return pointer to the data or nullptr
+	*/
+	const uint8_t* borrow(uint8_t* buf, uint32_t* len)
+	{
+		(void) buf;
 
-		std::copy_n(incomming_bytes_.begin(), bytes_to_copy, buf);
+		size_t contiguous_bytes = 0;
+		auto data = incomming_bytes_.data(&contiguous_bytes);
+		if (contiguous_bytes < *len)
+			return nullptr;
 
-		incomming_bytes_.erase(
-			incomming_bytes_.begin(),
-			incomming_bytes_.begin() + std::string::difference_type(bytes_to_copy)
-		);
+		*len = uint32_t(std::min<size_t>(contiguous_bytes, std::numeric_limits<uint32_t>::max()));
+		return data;
+	}
 
-		return uint32_t(bytes_to_copy);
+	/// Remove len bytes from the receive buffer, after they were borrow()ed.
+	void consume(uint32_t len)
+	{
+		if (len > available_bytes())
+		{
+			throw apache::thrift::transport::TTransportException(
+				apache::thrift::transport::TTransportException::BAD_ARGS,
+				"consume did not follow a borrow."
+			);
+		}
+		incomming_bytes_.consume(len);
 	}
 
 	/// the number of bytes, that have been received on not yet read()
@@ -108,6 +321,52 @@ class thrift_asio_transport
 		return incomming_bytes_.size();
 	}
 
+	/// copies up to len received bytes into buf without consuming them. Never blocks.
+	/*!
+	* @return How many bytes were copied
+	*/
+	size_t peek_bytes(uint8_t* buf, size_t len) const
+	{
+		return incomming_bytes_.peek(buf, len);
+	}
+
+	/// the number of bytes, that are requested from the socket per receive
+	size_t receive_buffer_size() const
+	{
+		return receive_sizer_.size();
+	}
+
+	/// returns counters, that can be used to tune receive_buffer_options
+	receive_statistics receive_stats() const
+	{
+		receive_statistics stats = receive_stats_;
+		stats.buffer_size = receive_sizer_.size();
+		stats.grow_count = receive_sizer_.grow_count();
+		stats.shrink_count = receive_sizer_.shrink_count();
+		stats.buffer_capacity = incomming_bytes_.capacity();
+		return stats;
+	}
+
+	/// the receive buffer, for owners of the socket, that receive into it themselves
+	/*!
+	* thrift_asio_server reads the requests of a connection itself, without open()ing its
+	* transport. It receives chunks of receive_buffer_size() bytes into this buffer and reports
+	* each receive with count_receive(), so that receive_stats() describes them.
+	* */
+	ring_buffer& receive_buffer()
+	{
+		return incomming_bytes_;
+	}
+
+	/// counts a receive of n bytes into receive_buffer() and adapts receive_buffer_size() to it
+	void count_receive(size_t n)
+	{
+		++receive_stats_.receive_count;
+		receive_stats_.bytes_received += n;
+		if (receive_sizer_.on_receive(n))
+			incomming_bytes_.shrink_to(4 * receive_sizer_.size());
+	}
+
 	/*uint32_t readAll(uint8_t* buf, uint32_t len)
 	{
 		return read(buf, len);
@@ -116,6 +375,8 @@ class thrift_asio_transport
 	/**
 	* asynchronously sends len bytes from buf.
 	*
+	* The bytes are copied into a pooled buffer, so buf can be reused
+	* immediately.
 	* In case of error, the event_handler::on_error will be invoked.
 	*
 	* @param buf  The data to write out
@@ -123,46 +384,183 @@ class thrift_asio_transport
 	*/
 	void write(const uint8_t* buf, uint32_t len)
 	{
-		outbound_messages_.push_back({buf, buf+len});
-		if (outbound_messages_.size() == 1 && !is_currently_writing_)
-		{
-			async_write_one();
-		}// the other case is handled in the completion handler in async_write_one
+		auto buffer = acquire_buffer();
+		buffer->assign(buf, buf + len);
+		write(shared_buffer(std::move(buffer)));
 	}
 
-	void async_write_one()
+	/// returns an empty buffer from the pool of already sent buffers
+	/*!
+	* Fill it and pass it to write(shared_buffer), so that its storage is reused
+	* once it was sent.
+	* */
+	std::shared_ptr<std::vector<uint8_t>> acquire_buffer()
 	{
-		// consolidate outbound messages
-		auto msg = std::make_shared<std::string>();
-		for(const auto& x : outbound_messages_)
+		std::lock_guard<std::mutex> lock(outbound_mutex_);
+		if (buffer_pool_.empty())
+			return std::make_shared<std::vector<uint8_t>>();
+
+		auto buffer = std::move(buffer_pool_.back());
+		buffer_pool_.pop_back();
+		return buffer;
+	}
+
+	/**
+	* asynchronously sends buffer without copying it.
+	*
+	* The same buffer can be queued on multiple transports, i.e. to
+	* broadcast a message. It must not be modified after it was queued.
+	* This may be called from any thread.
+	* In case of error, the event_handler::on_error will be invoked.
+	* If the outbound queue is full, the outbound_queue_options::policy is applied.
+	*
+	* @param buffer  The data to write out
+	*/
+	void write(shared_buffer buffer)
+	{
+		bool start_writing = false;
+		overflow_policy overflow = overflow_policy::notify;
+		bool overflowed = false;
+		outbound_statistics stats;
 		{
-            (*msg) += x;
+			std::lock_guard<std::mutex> lock(outbound_mutex_);
+			if (exceeds_outbound_limits(buffer->size()))
+			{
+				overflowed = true;
+				overflow = outbound_options_.policy;
+				++outbound_stats_.overflow_count;
+
+				switch (overflow)
+				{
+					case overflow_policy::drop_oldest:
+					{
+						size_t n = 0;
+						while (n < outbound_messages_.size() && exceeds_outbound_limits(buffer->size(), n))
+						{
+							outbound_bytes_ -= outbound_messages_[n]->size();
+							count_dropped_message(*outbound_messages_[n++]);
+						}
+						if (!outbound_traces_.empty())
+							forget_traces(n);
+						outbound_messages_.erase(outbound_messages_.begin(), outbound_messages_.begin() + n);
+						break;
+					}
+					case overflow_policy::drop_newest:
+						count_dropped_message(*buffer);
+						return;
+					case overflow_policy::disconnect:
+						buffer.reset();
+						break;
+					case overflow_policy::notify:
+						break;
+				}
+			}
+
+			if (buffer)
+			{
+				outbound_bytes_ += buffer->size();
+				outbound_messages_.push_back(std::move(buffer));
+				outbound_stats_.peak_queued_bytes
+					= std::max(outbound_stats_.peak_queued_bytes, outbound_bytes_);
+				start_writing = !is_currently_writing_;
+				is_currently_writing_ = true;
+				if (metrics_enabled && metrics_)
+					metrics_->frames_out.fetch_add(1, std::memory_order_relaxed);
+				if (tracing_enabled && tracer_ && tracer_->current_request() != 0)
+					trace_write_queued(*outbound_messages_.back());
+			}
+			publish_outbound_bytes();
+			stats = outbound_stats_locked();
 		}
-		outbound_messages_.clear();
 
-        auto self = shared_from_this();
-        assert(!is_currently_writing_);
-        is_currently_writing_ = true;
-        boost::asio::async_write(
-			*socket_,
-			boost::asio::buffer(msg->data(), msg->size()),
-			[this, self, msg](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/)
+		if (overflowed && overflow == overflow_policy::notify)
+		{
+			event_handlers_->on_backpressure(stats);
+		}
+		else if (overflowed && overflow == overflow_policy::disconnect)
+		{
+			auto self = shared_from_this();
+			strand_.dispatch([this, self]
 			{
-                is_currently_writing_ = false;
-                if (ec)
-                {
-                    event_handlers_->on_error(ec);
-                    this->close();
-                }
-                else
-                {
-                    if (!outbound_messages_.empty())
-                    {
-                        async_write_one();
-                    }
-                }
+				if (!isOpen())
+					return;
+				event_handlers_->on_error(boost::asio::error::no_buffer_space);
+				this->close();
+			});
+		}
+
+		if (start_writing)
+		{
+			// the socket may only be used from within the strand
+			auto self = shared_from_this();
+			strand_.dispatch([this, self]{ async_write_one(); });
+		}// the other case is handled in the completion handler in async_write_one
+	}
+
+	/// the number of bytes, that were written, but not yet sent
+	size_t outbound_bytes() const
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex_);
+		return outbound_bytes_;
+	}
+
+	/// returns counters, that describe the outbound queue
+	outbound_statistics outbound_stats() const
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex_);
+		return outbound_stats_locked();
+	}
+
+	/// invokes f from within the strand, once at most low_water_mark bytes wait to be sent
+	/*!
+	* If that is already the case, f is dispatched immediately. f is also invoked,
+	* when the transport is closed. Only one handler can be waiting at a time.
+	* */
+	void async_wait_for_drain(size_t low_water_mark, std::function<void()> f)
+	{
+		{
+			std::lock_guard<std::mutex> lock(outbound_mutex_);
+			if (outbound_bytes_ > low_water_mark)
+			{
+				assert(!drain_handler_);
+				drain_low_water_mark_ = low_water_mark;
+				drain_handler_ = std::move(f);
+				return;
 			}
-		);
+		}
+		strand_.dispatch(f);
+	}
+
+	/// counts the bytes and frames of this transport into m
+	/*!
+	* Must be called before the transport is used. thrift_asio_server does this,
+	* if server_options::metrics is set.
+	* */
+	void set_metrics(std::shared_ptr<connection_metrics> m)
+	{
+		metrics_ = std::move(m);
+	}
+
+	/// records write_queued and write_completed events into t
+	/*!
+	* Only frames, that are written while t->current_request() is set, are traced.
+	* Must be called before the transport is used. thrift_asio_server does this,
+	* if server_options::tracer is set.
+	* */
+	void set_tracer(std::shared_ptr<tracer> t, uint64_t connection_id)
+	{
+		tracer_ = std::move(t);
+		trace_connection_id_ = connection_id;
+	}
+
+	/// the strand, that serializes all operations on the socket
+	/*!
+	* If the io_service is run by multiple threads, everything that touches
+	* the socket or the receive buffer has to be dispatched through this strand.
+	* */
+	boost::asio::io_service::strand& strand()
+	{
+		return strand_;
 	}
 
 	/// return true unless an error occured or the transport was closed
@@ -194,17 +592,7 @@ class thrift_asio_transport
 		event_handlers_->on_connected();
 
 		socket_->set_option(boost::asio::ip::tcp::no_delay(true));
-		auto receive_buffer = std::make_shared<std::array<char, BUFFER_SIZE>>();
-
-		socket_->async_receive(
-			boost::asio::buffer(*receive_buffer, receive_buffer->size()),
-			0,
-			[this, receive_buffer]
-				(const boost::system::error_code& ec, std::size_t bytes_transferred)
-			{
-				this->on_receive(ec, receive_buffer, bytes_transferred);
-			}
-		);
+		async_receive();
 	}
 
 	/// closes the transport
@@ -221,7 +609,17 @@ class thrift_asio_transport
 		}
 		event_handlers_->on_disconnected();
 		incomming_bytes_.clear();
-		outbound_messages_.clear();
+
+		std::function<void()> drained;
+		{
+			std::lock_guard<std::mutex> lock(outbound_mutex_);
+			outbound_messages_.clear();
+			outbound_bytes_ = bytes_in_flight_;
+			publish_outbound_bytes();
+			outbound_traces_.clear();
+			drained.swap(drain_handler_);
+		}
+		if (drained) strand_.post(drained);
 	}
 
 
@@ -241,16 +639,217 @@ class thrift_asio_transport
   protected:
 	socket_ptr socket_; ///< the underlying socket
 	event_handlers* event_handlers_; ///< handles events like on_error, etc.
+	boost::asio::io_service::strand strand_; ///< serializes the handlers of socket_
 
   private:
-	std::deque<uint8_t> incomming_bytes_;
-	std::list<std::string> outbound_messages_;
-	bool is_currently_writing_ = false;
+	receive_buffer_sizer receive_sizer_;
+	receive_statistics receive_stats_; ///< only the counters are maintained, see receive_stats()
+
+	ring_buffer incomming_bytes_;
+	std::vector<shared_buffer> outbound_messages_;
+	std::vector<shared_buffer> in_flight_messages_;
+	std::vector<boost::asio::const_buffer> gather_buffers_;
+	std::vector<std::shared_ptr<std::vector<uint8_t>>> buffer_pool_;
+	bool is_currently_writing_ = false; ///< true, while a write is in flight or scheduled
+	size_t outbound_bytes_ = 0; ///< bytes in outbound_messages_ and in_flight_messages_
+	size_t bytes_in_flight_ = 0; ///< bytes in in_flight_messages_
+	size_t drain_low_water_mark_ = 0;
+	std::function<void()> drain_handler_; ///< see async_wait_for_drain
+	const outbound_queue_options outbound_options_;
+	outbound_statistics outbound_stats_; ///< only the counters are maintained, see outbound_stats()
+	mutable std::mutex outbound_mutex_; ///< guards everything above, that is related to writing
+	std::shared_ptr<connection_metrics> metrics_; ///< see set_metrics
+	std::shared_ptr<tracer> tracer_; ///< see set_tracer
+	uint64_t trace_connection_id_ = 0;
+	struct traced_frame
+	{
+		const std::vector<uint8_t>* buffer; ///< only compared, it might be gone
+		uint64_t request_id;
+		size_t size;
+	};
+	std::vector<traced_frame> outbound_traces_; ///< the traced frames in outbound_messages_
+	std::vector<traced_frame> in_flight_traces_; ///< the traced frames in in_flight_messages_
+
+	// buffers larger than this are not kept in the pool
+	static constexpr size_t MAX_POOLED_BUFFER_SIZE = 64 * 1024;
+	static constexpr size_t MAX_POOLED_BUFFERS = 16;
+
+	// refers to gather_buffers_ without copying it into the write operation
+	struct const_buffer_view
+	{
+		typedef boost::asio::const_buffer value_type;
+		typedef const boost::asio::const_buffer* const_iterator;
+
+		explicit const_buffer_view(const std::vector<boost::asio::const_buffer>& buffers)
+			: begin_(buffers.data())
+			, end_(buffers.data() + buffers.size())
+		{
+		}
+
+		const_iterator begin() const { return begin_; }
+		const_iterator end() const { return end_; }
+
+	  private:
+		const_iterator begin_;
+		const_iterator end_;
+	};
+
+	// true, if queueing additional_bytes would exceed the outbound_options_,
+	// not counting the first skipped_messages of outbound_messages_.
+	// outbound_mutex_ must be locked.
+	bool exceeds_outbound_limits(size_t additional_bytes, size_t skipped_messages = 0) const
+	{
+		auto queued_messages = outbound_messages_.size() - skipped_messages + in_flight_messages_.size();
+		return (outbound_options_.max_bytes != 0
+				&& outbound_bytes_ + additional_bytes > outbound_options_.max_bytes)
+			|| (outbound_options_.max_messages != 0
+				&& queued_messages + 1 > outbound_options_.max_messages);
+	}
+
+	// outbound_mutex_ must be locked
+	void count_dropped_message(const std::vector<uint8_t>& message)
+	{
+		++outbound_stats_.dropped_messages;
+		outbound_stats_.dropped_bytes += message.size();
+	}
+
+	// outbound_mutex_ must be locked
+	outbound_statistics outbound_stats_locked() const
+	{
+		outbound_statistics stats = outbound_stats_;
+		stats.queued_bytes = outbound_bytes_;
+		stats.queued_messages = outbound_messages_.size() + in_flight_messages_.size();
+		return stats;
+	}
 
-	void on_receive(
-		const boost::system::error_code& ec,
-		std::shared_ptr<std::array<char, BUFFER_SIZE>> receive_buffer,
-		std::size_t bytes_transferred)
+	// hands all outbound messages to a single gathering write.
+	// Must be called from within strand_ and with is_currently_writing_ set.
+	void async_write_one()
+	{
+		{
+			std::lock_guard<std::mutex> lock(outbound_mutex_);
+			assert(is_currently_writing_);
+			assert(in_flight_messages_.empty());
+			in_flight_messages_.swap(outbound_messages_);
+			bytes_in_flight_ = outbound_bytes_;
+			in_flight_traces_.swap(outbound_traces_);
+		}
+
+		gather_buffers_.clear();
+		for(const auto& x : in_flight_messages_)
+		{
+			gather_buffers_.push_back(boost::asio::buffer(*x));
+		}
+
+        auto self = shared_from_this();
+        boost::asio::async_write(
+			*socket_,
+			const_buffer_view(gather_buffers_),
+			strand_.wrap([this, self](const boost::system::error_code& ec, std::size_t bytes_transferred)
+			{
+                bool write_more = false;
+                std::function<void()> drained;
+                {
+                    std::lock_guard<std::mutex> lock(outbound_mutex_);
+                    recycle_in_flight_messages();
+                    outbound_bytes_ -= bytes_in_flight_;
+                    bytes_in_flight_ = 0;
+                    if (metrics_enabled && metrics_)
+                        metrics_->bytes_out.fetch_add(bytes_transferred, std::memory_order_relaxed);
+                    publish_outbound_bytes();
+                    for (const auto& t : in_flight_traces_)
+                        tracer_->record(trace_event::write_completed, trace_connection_id_, t.request_id, t.size);
+                    in_flight_traces_.clear();
+                    write_more = !ec && !outbound_messages_.empty();
+                    is_currently_writing_ = write_more;
+                    if (drain_handler_ && outbound_bytes_ <= drain_low_water_mark_)
+                        drained.swap(drain_handler_);
+                }
+
+                if (drained) drained();
+
+                if (ec)
+                {
+                    event_handlers_->on_error(ec);
+                    this->close();
+                }
+                else if (write_more)
+                {
+                    async_write_one();
+                }
+			})
+		);
+	}
+
+	// traces the frame, that was just queued, as part of tracer_->current_request().
+	// outbound_mutex_ must be locked.
+	void trace_write_queued(const std::vector<uint8_t>& buffer)
+	{
+		traced_frame t = { &buffer, tracer_->current_request(), buffer.size() };
+		outbound_traces_.push_back(t);
+		tracer_->record(trace_event::write_queued, trace_connection_id_, t.request_id, t.size);
+	}
+
+	// forgets the traced frames among the first n outbound_messages_, as they are dropped.
+	// outbound_mutex_ must be locked.
+	void forget_traces(size_t n)
+	{
+		auto is_dropped = [&](const traced_frame& t)
+		{
+			for (size_t i = 0; i < n; ++i)
+				if (outbound_messages_[i].get() == t.buffer)
+					return true;
+			return false;
+		};
+		outbound_traces_.erase(
+			std::remove_if(outbound_traces_.begin(), outbound_traces_.end(), is_dropped),
+			outbound_traces_.end()
+		);
+	}
+
+	// updates the outbound queue gauge of metrics_. outbound_mutex_ must be locked.
+	void publish_outbound_bytes()
+	{
+		if (metrics_enabled && metrics_)
+			metrics_->outbound_queue_bytes.store(outbound_bytes_, std::memory_order_relaxed);
+	}
+
+	// puts the written buffers, that are not shared with anybody else, back into the pool.
+	// outbound_mutex_ must be locked.
+	void recycle_in_flight_messages()
+	{
+		for(auto& x : in_flight_messages_)
+		{
+			if (x.use_count() == 1
+				&& x->capacity() <= MAX_POOLED_BUFFER_SIZE
+				&& buffer_pool_.size() < MAX_POOLED_BUFFERS)
+			{
+				auto buffer = std::const_pointer_cast<std::vector<uint8_t>>(x);
+				buffer->clear();
+				buffer_pool_.push_back(std::move(buffer));
+			}
+		}
+		in_flight_messages_.clear();
+	}
+
+	// receive straight into the free space of incomming_bytes_.
+	// The ring buffer only grows (or shrinks) here, so the spans stay valid
+	// while read()/consume() advance the head.
+	void async_receive()
+	{
+		incomming_bytes_.reserve(receive_sizer_.size());
+
+		socket_->async_receive(
+			incomming_bytes_.prepare(receive_sizer_.size()),
+			0,
+			strand_.wrap([this](const boost::system::error_code& ec, std::size_t bytes_transferred)
+			{
+				this->on_receive(ec, bytes_transferred);
+			})
+		);
+	}
+
+	void on_receive(const boost::system::error_code& ec, std::size_t bytes_transferred)
 	{
 		if (ec)
 		{
@@ -259,23 +858,15 @@ class thrift_asio_transport
 		}
 		else
 		{
-			incomming_bytes_.insert(
-				incomming_bytes_.end(),
-				begin(*receive_buffer),
-				begin(*receive_buffer) + bytes_transferred
-			);
+			incomming_bytes_.commit(bytes_transferred);
+
+			if (metrics_enabled && metrics_)
+				metrics_->bytes_in.fetch_add(bytes_transferred, std::memory_order_relaxed);
+			count_receive(bytes_transferred);
 
 			//std::clog << "got " << bytes_transferred << " bytes, avail=" << available_bytes() << std::endl;
 
-			socket_->async_receive(
-				boost::asio::buffer(*receive_buffer, receive_buffer->size()),
-				0,
-				[this, receive_buffer](const boost::system::error_code& ec,
-					std::size_t bytes_transferred)
-				{
-					this->on_receive(ec, receive_buffer, bytes_transferred);
-				}
-			);
+			async_receive();
 		}
 	}
 };
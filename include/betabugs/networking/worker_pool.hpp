@@ -0,0 +1,275 @@
+#ifndef _THRIFT_ASIO_WORKER_POOL_HPP_
+#define _THRIFT_ASIO_WORKER_POOL_HPP_
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace betabugs {
+namespace networking {
+
+/*!
+* A pool of threads, that run CPU-heavy tasks away from the io_service.
+*
+* Every worker has its own queue. Tasks are distributed over the queues in a
+* round-robin fashion, workers take tasks from the front of their own queue and
+* steal from the back of the others, when theirs is empty.
+*
+* The queue depth is bounded by max_queue_depth: post() always queues the task, but
+* reports, when the limit is reached. The poster is expected to stop producing tasks
+* until async_wait_for_capacity() calls back. thrift_asio_server does so per connection
+* (see thrift_asio_server::server_options::workers).
+*
+* @code
+* auto workers = std::make_shared<betabugs::networking::worker_pool>(4, 1024);
+* thrift_asio_server<my_handler>::server_options options;
+* options.workers = workers;
+* @endcode
+* */
+class worker_pool
+{
+  public:
+	/// counters describing the load of a worker_pool
+	struct statistics
+	{
+		size_t queue_depth = 0;         ///< tasks, that are queued, but not started yet
+		size_t peak_queue_depth = 0;    ///< the maximum of queue_depth so far
+		uint64_t tasks_executed = 0;    ///< tasks, that were run to completion
+		uint64_t tasks_stolen = 0;      ///< tasks, that were run by another worker than the one they were queued for
+		uint64_t overflow_count = 0;    ///< how often post() reported, that max_queue_depth was reached
+	};
+
+	/// starts num_threads workers (one per core, if zero). max_queue_depth of zero means unbounded.
+	explicit worker_pool(size_t num_threads = 0, size_t max_queue_depth = 0)
+		: max_queue_depth_(max_queue_depth)
+		, next_queue_(0)
+		, queue_depth_(0)
+		, peak_queue_depth_(0)
+		, tasks_executed_(0)
+		, tasks_stolen_(0)
+		, overflow_count_(0)
+		, is_stopped_(false)
+	{
+		if (num_threads == 0)
+			num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+		for (size_t i = 0; i < num_threads; ++i)
+			queues_.emplace_back(new task_queue());
+
+		for (size_t i = 0; i < num_threads; ++i)
+			threads_.emplace_back([this, i]{ run(i); });
+	}
+
+	worker_pool(const worker_pool&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+
+	/// stops the workers, after they ran the queued tasks
+	~worker_pool()
+	{
+		stop();
+	}
+
+	/// the number of workers
+	size_t size() const
+	{
+		return queues_.size();
+	}
+
+	/// queues task. Can be called from any thread.
+	/*!
+	* After stop(), task is run right away by the calling thread, so it is never lost.
+	*
+	* @returns false, if max_queue_depth is reached. The task is queued nevertheless.
+	* */
+	bool post(std::function<void()> task)
+	{
+		{
+			// the lock makes sure, that a worker, that is about to wait or to stop, sees the task
+			std::unique_lock<std::mutex> lock(idle_mutex_);
+			if (is_stopped_)
+			{
+				lock.unlock();
+				task();
+				return true;
+			}
+
+			// counted first, so that the worker, that takes it, never decrements below zero
+			size_t depth = ++queue_depth_;
+			size_t peak = peak_queue_depth_;
+			while (depth > peak && !peak_queue_depth_.compare_exchange_weak(peak, depth))
+				;
+
+			auto& queue = *queues_[next_queue_++ % queues_.size()];
+			std::lock_guard<std::mutex> queue_lock(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+		idle_.notify_one();
+
+		if (has_capacity())
+			return true;
+
+		++overflow_count_;
+		return false;
+	}
+
+	/// true, if the queue depth is below max_queue_depth
+	bool has_capacity() const
+	{
+		return max_queue_depth_ == 0 || queue_depth_ < max_queue_depth_;
+	}
+
+	/// calls f from a worker thread, once the queue depth is below max_queue_depth again
+	/*!
+	* f is called right away, if it already is.
+	* */
+	void async_wait_for_capacity(std::function<void()> f)
+	{
+		{
+			std::lock_guard<std::mutex> lock(capacity_mutex_);
+			if (!has_capacity())
+			{
+				capacity_waiters_.push_back(std::move(f));
+				return;
+			}
+		}
+		f();
+	}
+
+	/// returns counters, that can be used to size the pool
+	statistics stats() const
+	{
+		statistics stats;
+		stats.queue_depth = queue_depth_;
+		stats.peak_queue_depth = peak_queue_depth_;
+		stats.tasks_executed = tasks_executed_;
+		stats.tasks_stolen = tasks_stolen_;
+		stats.overflow_count = overflow_count_;
+		return stats;
+	}
+
+	/// stops the workers, after they ran the queued tasks, and joins them
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex_);
+			is_stopped_ = true;
+		}
+		idle_.notify_all();
+
+		for (auto& thread : threads_)
+		{
+			if (thread.joinable())
+				thread.join();
+		}
+	}
+
+  private:
+	struct task_queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<task_queue>> queues_;
+	std::vector<std::thread> threads_;
+	const size_t max_queue_depth_;
+
+	std::atomic<size_t> next_queue_;
+	std::atomic<size_t> queue_depth_;
+	std::atomic<size_t> peak_queue_depth_;
+	std::atomic<uint64_t> tasks_executed_;
+	std::atomic<uint64_t> tasks_stolen_;
+	std::atomic<uint64_t> overflow_count_;
+
+	std::mutex idle_mutex_; ///< guards is_stopped_
+	std::condition_variable idle_;
+	bool is_stopped_;
+
+	std::mutex capacity_mutex_; ///< guards capacity_waiters_
+	std::vector<std::function<void()>> capacity_waiters_;
+
+	void run(size_t index)
+	{
+		std::function<void()> task;
+		for (;;)
+		{
+			if (pop(index, task))
+			{
+				on_dequeued();
+				task();
+				task = nullptr;
+				++tasks_executed_;
+				continue;
+			}
+
+			// the queues are drained, before the worker stops
+			std::unique_lock<std::mutex> lock(idle_mutex_);
+			idle_.wait(lock, [this]{ return is_stopped_ || queue_depth_ != 0; });
+			if (is_stopped_ && queue_depth_ == 0)
+				return;
+		}
+	}
+
+	// takes a task from the front of the own queue or steals one from the back of another
+	bool pop(size_t index, std::function<void()>& task)
+	{
+		{
+			auto& queue = *queues_[index];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				return true;
+			}
+		}
+
+		for (size_t i = 1; i < queues_.size(); ++i)
+		{
+			auto& queue = *queues_[(index + i) % queues_.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+				++tasks_stolen_;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// wakes up those, that wait for capacity
+	void on_dequeued()
+	{
+		--queue_depth_;
+		if (max_queue_depth_ == 0)
+			return;
+
+		std::vector<std::function<void()>> waiters;
+		{
+			std::lock_guard<std::mutex> lock(capacity_mutex_);
+			if (capacity_waiters_.empty() || !has_capacity())
+				return;
+			waiters.swap(capacity_waiters_);
+		}
+
+		for (auto& f : waiters)
+			f();
+	}
+};
+
+}
+}
+
+#endif //_THRIFT_ASIO_WORKER_POOL_HPP_
@@ -10,3 +10,16 @@
 
 #include "test_asynchronous.cpp"
 #include "test_synchronous.cpp"
+#include "test_ring_buffer.cpp"
+#include "test_multithreaded.cpp"
+#include "test_outbound_queue.cpp"
+#include "test_compression.cpp"
+#include "test_worker_pool.cpp"
+#include "test_log.cpp"
+#include "test_receive_buffer.cpp"
+#include "test_connection_management.cpp"
+#include "test_sharded_server.cpp"
+#include "test_server_limits.cpp"
+#include "test_framed_transport.cpp"
+#include "test_server_reads.cpp"
+#include "test_write_path.cpp"
@@ -11,6 +11,7 @@
 #endif /* BOOST_TEST_MODULE */
 
 #include <iostream>
+#include <thrift/TApplicationException.h>
 #include <thrift/protocol/TBinaryProtocol.h>
 
 #include <asynchronous_server.h>
@@ -22,6 +23,7 @@
 #include <betabugs/networking/thrift_asio_connection_management_mixin.hpp>
 #include <thread>
 #include <future>
+#include <sstream>
 
 
 class asynchronous_server_handler : public test::asynchronous_serverIf
@@ -83,6 +85,135 @@ class asynchronous_client_handler : public betabugs::networking::thrift_asio_cli
 };
 
 
+/// sends the result of add to all clients, but the one that asked for it
+class broadcasting_server_handler : public test::asynchronous_serverIf
+									, public betabugs::networking::thrift_asio_transport::event_handlers
+									, public betabugs::networking::thrift_asio_connection_management_mixin<test::asynchronous_clientClient>
+{
+  public:
+	virtual void add(const int32_t a, const int32_t b) override
+	{
+		assert(current_client_);
+		broadcast([&](test::asynchronous_clientClient& client){ client.on_added(a + b); }, current_client_);
+	}
+
+	size_t num_clients()
+	{
+		std::lock_guard<std::mutex> lock(clients_mutex_);
+		return clients_.size();
+	}
+};
+
+
+/// a client, that only listens
+class listening_client_handler : public betabugs::networking::thrift_asio_client<
+	test::asynchronous_serverClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::asynchronous_serverClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf
+	>::thrift_asio_client;
+
+	int32_t last_result = 0;
+
+	virtual void on_added(const int32_t result) override
+	{
+		last_result = result;
+	}
+};
+
+
+/// like asynchronous_client_handler, but speaks TCompactProtocol
+class compact_client_handler : public betabugs::networking::thrift_asio_client<
+	test::asynchronous_serverClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf,
+	false,
+	betabugs::networking::compact_protocol
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::asynchronous_serverClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf,
+		false,
+		betabugs::networking::compact_protocol
+	>::thrift_asio_client;
+
+	int32_t last_result = 0;
+
+	virtual void on_added(const int32_t result) override
+	{
+		last_result = result;
+	}
+
+	virtual void on_connected() override
+	{
+		client_.add(20, 22);
+	}
+};
+
+
+/// sends three requests at once and counts the results
+class counting_client_handler : public betabugs::networking::thrift_asio_client<
+	test::asynchronous_serverClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::asynchronous_serverClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf
+	>::thrift_asio_client;
+
+	int num_results = 0;
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+		++num_results;
+	}
+
+	virtual void on_connected() override
+	{
+		client_.add(1, 1);
+		client_.add(2, 2);
+		client_.add(3, 3);
+	}
+};
+
+
+/// sends the oneway add with async_call
+class oneway_client_handler : public counting_client_handler
+{
+  public:
+	using counting_client_handler::counting_client_handler;
+
+	std::future<void> sent;
+	std::future<int32_t> with_result;
+
+	virtual void on_connected() override
+	{
+		sent = async_call(
+			[](test::asynchronous_serverClient& c){ c.send_add(20, 22); },
+			[](test::asynchronous_serverClient&){}
+		);
+		with_result = async_call(
+			[](test::asynchronous_serverClient& c){ c.send_add(1, 1); },
+			[](test::asynchronous_serverClient&){ return int32_t(0); }
+		);
+	}
+};
+
+
 BOOST_AUTO_TEST_SUITE(test_asynchrounous)
 
 BOOST_AUTO_TEST_CASE(test_asynchrounous_basic)
@@ -125,4 +256,343 @@ BOOST_AUTO_TEST_CASE(test_asynchrounous_basic)
 	BOOST_CHECK_GT(num_iterations, 0);
 }
 
+BOOST_AUTO_TEST_CASE(test_asynchrounous_broadcast)
+{
+	const unsigned short port = 1340;
+
+	auto handler = boost::make_shared<broadcasting_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<broadcasting_server_handler>::serve(io_service, processor, handler, port);
+
+	// the listeners have to be connected, before the sender calls add
+	listening_client_handler listener1(io_service, "127.0.0.1", std::to_string(port));
+	listening_client_handler listener2(io_service, "127.0.0.1", std::to_string(port));
+	for (int i = 0; i < 50 && handler->num_clients() < 2; ++i)
+	{
+		while (io_service.poll_one());
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	BOOST_REQUIRE_EQUAL(handler->num_clients(), 2u);
+
+	asynchronous_client_handler sender(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations)
+	{
+		while (io_service.poll_one())
+		{
+			listener1.update();
+			listener2.update();
+			sender.update();
+		}
+
+		if (listener1.last_result != 0 && listener2.last_result != 0)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+	BOOST_CHECK_EQUAL(listener1.last_result, 42);
+	BOOST_CHECK_EQUAL(listener2.last_result, 42);
+	BOOST_CHECK_EQUAL(sender.last_result, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_asynchrounous_compact_protocol)
+{
+	const unsigned short port = 1341;
+
+	auto handler = boost::make_shared<asynchronous_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<
+		asynchronous_server_handler, false, betabugs::networking::compact_protocol
+	>::serve(io_service, processor, handler, port);
+
+	compact_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations)
+	{
+		while (io_service.poll_one())
+		{
+			client_handler.update();
+		}
+
+		if (client_handler.last_result != 0)
+		{
+			BOOST_CHECK_EQUAL(client_handler.last_result, 42);
+			break;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_asynchrounous_update_budget)
+{
+	const unsigned short port = 1342;
+
+	auto handler = boost::make_shared<asynchronous_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::serve(io_service, processor, handler, port);
+
+	counting_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations && client_handler.num_results < 3)
+	{
+		while (io_service.poll_one())
+			;
+
+		// never more than one call per update_n(1)
+		auto result = client_handler.update_n(1);
+		BOOST_CHECK_LE(result.processed, 1u);
+		if (result.processed == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_EQUAL(client_handler.num_results, 3);
+
+	auto result = client_handler.update_for(std::chrono::milliseconds(10));
+	BOOST_CHECK_EQUAL(result.processed, 0u);
+	BOOST_CHECK(!result.backlog);
+}
+
+BOOST_AUTO_TEST_CASE(test_asynchrounous_oneway_async_call)
+{
+	const unsigned short port = 1358;
+
+	auto handler = boost::make_shared<asynchronous_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::serve(io_service, processor, handler, port);
+
+	oneway_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations && client_handler.num_results < 2)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_EQUAL(client_handler.num_results, 2);
+
+	// the calls were complete, once they were sent
+	BOOST_CHECK_EQUAL(client_handler.pending_calls(), 0u);
+	BOOST_REQUIRE(client_handler.sent.valid());
+	BOOST_CHECK_NO_THROW(client_handler.sent.get());
+	BOOST_CHECK_THROW(client_handler.with_result.get(), apache::thrift::TApplicationException);
+}
+
+#ifndef THRIFT_ASIO_NO_METRICS
+BOOST_AUTO_TEST_CASE(test_asynchrounous_metrics)
+{
+	const unsigned short port = 1347;
+
+	auto handler = boost::make_shared<asynchronous_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	auto metrics = std::make_shared<betabugs::networking::metrics_registry>();
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::server_options options;
+	options.metrics = metrics;
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::serve(io_service, processor, handler, port, options);
+
+	asynchronous_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations && client_handler.last_result == 0)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	BOOST_CHECK_EQUAL(client_handler.last_result, 42);
+
+	auto stats = metrics->stats();
+	BOOST_CHECK_EQUAL(stats.connections_accepted, 1u);
+	BOOST_CHECK_EQUAL(stats.connections.size(), 1u);
+	BOOST_CHECK_EQUAL(stats.frames_in, 1u);
+	BOOST_CHECK_EQUAL(stats.frames_out, 1u);
+	BOOST_CHECK_GT(stats.bytes_in, 0u);
+	BOOST_REQUIRE_EQUAL(stats.methods.size(), 1u);
+	BOOST_CHECK_EQUAL(stats.methods[0].name, "add");
+	BOOST_CHECK_EQUAL(stats.methods[0].calls, 1u);
+	BOOST_CHECK_EQUAL(stats.methods[0].durations.count, 1u);
+
+	auto text = metrics->prometheus_text();
+	BOOST_CHECK(text.find("thrift_asio_calls_total{method=\"add\"} 1\n") != std::string::npos);
+	BOOST_CHECK(text.find("thrift_asio_call_duration_seconds_bucket{method=\"add\",le=\"+Inf\"} 1\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_asynchrounous_metrics_unknown_method)
+{
+	const unsigned short port = 1352;
+
+	auto handler = boost::make_shared<asynchronous_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	boost::asio::io_service io_service;
+
+	auto metrics = std::make_shared<betabugs::networking::metrics_registry>();
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::server_options options;
+	options.metrics = metrics;
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::serve(io_service, processor, handler, port, options);
+
+	// calls of more methods, than the registry has slots for, that the processor does not know
+	const size_t num_calls = betabugs::networking::metrics_registry::max_methods + 10;
+	std::string frames;
+	for (size_t i = 0; i < num_calls; ++i)
+	{
+		auto buffer = boost::make_shared<apache::thrift::transport::TMemoryBuffer>();
+		apache::thrift::protocol::TBinaryProtocol protocol(buffer);
+		protocol.writeMessageBegin("no_such_method_" + std::to_string(i), apache::thrift::protocol::T_CALL, 0);
+		protocol.writeStructBegin("args");
+		protocol.writeFieldStop();
+		protocol.writeStructEnd();
+		protocol.writeMessageEnd();
+
+		uint8_t* data = nullptr;
+		uint32_t size = 0;
+		buffer->getBuffer(&data, &size);
+		uint32_t frame_size = htonl(size);
+		frames.append(reinterpret_cast<const char*>(&frame_size), sizeof(frame_size));
+		frames.append(reinterpret_cast<const char*>(data), size);
+	}
+
+	boost::asio::ip::tcp::socket client(io_service);
+	client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+	boost::asio::write(client, boost::asio::buffer(frames));
+
+	int num_iterations = 5000 / 10;
+	while (--num_iterations && metrics->unknown_method().calls < num_calls)
+	{
+		io_service.poll();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	// they are all counted as one method
+	auto stats = metrics->stats();
+	BOOST_REQUIRE_EQUAL(stats.methods.size(), 1u);
+	BOOST_CHECK_EQUAL(stats.methods[0].name, "unknown");
+	BOOST_CHECK_EQUAL(stats.methods[0].calls, num_calls);
+}
+#endif
+
+#ifndef THRIFT_ASIO_NO_TRACING
+BOOST_AUTO_TEST_CASE(test_asynchrounous_tracing)
+{
+	const unsigned short port = 1348;
+	using betabugs::networking::trace_event;
+
+	auto handler = boost::make_shared<asynchronous_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	auto buffer = std::make_shared<betabugs::networking::trace_buffer>(64);
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::server_options options;
+	options.tracer = std::make_shared<betabugs::networking::tracer>(buffer);
+	betabugs::networking::thrift_asio_server<asynchronous_server_handler>::serve(io_service, processor, handler, port, options);
+
+	asynchronous_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	// the reply is traced until its write completed
+	int num_iterations = 5000 / 10;
+	while (--num_iterations && buffer->records().size() < 6)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	BOOST_CHECK_EQUAL(client_handler.last_result, 42);
+
+	auto records = buffer->records();
+	BOOST_REQUIRE_EQUAL(records.size(), 6u);
+	const trace_event expected[] = {
+		trace_event::frame_started, trace_event::frame_received,
+		trace_event::dispatch_begin, trace_event::write_queued,
+		trace_event::dispatch_end, trace_event::write_completed
+	};
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		BOOST_CHECK(records[i].event == expected[i]);
+		BOOST_CHECK_EQUAL(records[i].request_id, records[0].request_id);
+	}
+
+	std::ostringstream json;
+	buffer->write_chrome_trace(json);
+	BOOST_CHECK(json.str().find("\"name\":\"process\"") != std::string::npos);
+	BOOST_CHECK(json.str().find("\"name\":\"send\"") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_asynchrounous_tracing_foreign_request)
+{
+	using betabugs::networking::tracer;
+	using betabugs::networking::trace_event;
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+	boost::asio::ip::tcp::socket peer(io_service);
+	peer.connect(acceptor.local_endpoint());
+	acceptor.accept(*socket);
+
+	betabugs::networking::thrift_asio_transport::event_handlers handlers;
+	auto transport = boost::make_shared<betabugs::networking::thrift_asio_transport>(socket, &handlers);
+	auto buffer = std::make_shared<betabugs::networking::trace_buffer>(64);
+	auto own_tracer = std::make_shared<tracer>(buffer);
+	tracer other_tracer(std::make_shared<betabugs::networking::trace_buffer>(64));
+	transport->set_tracer(own_tracer, own_tracer->new_connection_id());
+
+	const uint8_t frame[] = { 0, 0, 0, 1, 42 };
+
+	// a request of another tracer, i.e. of another server, is not attributed to this transport
+	{
+		tracer::request_scope scope(&other_tracer, other_tracer.start_request());
+		BOOST_CHECK_EQUAL(own_tracer->current_request(), 0u);
+		transport->write(frame, sizeof(frame));
+		transport->flush();
+	}
+	BOOST_CHECK(buffer->records().empty());
+
+	// unlike a request of its own tracer
+	const uint64_t request_id = own_tracer->start_request();
+	{
+		tracer::request_scope scope(own_tracer.get(), request_id);
+		BOOST_CHECK_EQUAL(own_tracer->current_request(), request_id);
+		BOOST_CHECK_EQUAL(other_tracer.current_request(), 0u);
+		transport->write(frame, sizeof(frame));
+		transport->flush();
+	}
+	BOOST_CHECK_EQUAL(own_tracer->current_request(), 0u);
+
+	auto records = buffer->records();
+	BOOST_REQUIRE(!records.empty());
+	BOOST_CHECK(records[0].event == trace_event::write_queued);
+	BOOST_CHECK_EQUAL(records[0].request_id, request_id);
+
+	while (transport->outbound_bytes() != 0)
+		io_service.run_one();
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,240 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_compression
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_compression.hpp>
+#include <betabugs/networking/thrift_asio_framed_transport.hpp>
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <boost/asio/write.hpp>
+#include <thrift/transport/TBufferTransports.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// records the frames, that thrift_asio_server passes to the processor
+struct recording_processor : public apache::thrift::TProcessor
+{
+	std::vector<std::vector<uint8_t>> frames;
+
+	virtual bool process(
+		boost::shared_ptr<apache::thrift::protocol::TProtocol> in,
+		boost::shared_ptr<apache::thrift::protocol::TProtocol> out,
+		void* connection_context
+	) override
+	{
+		(void) out;
+		(void) connection_context;
+
+		uint8_t* data = nullptr;
+		uint32_t size = 0;
+		boost::static_pointer_cast<apache::thrift::transport::TMemoryBuffer>(in->getTransport())->getBuffer(&data, &size);
+		frames.emplace_back(data, data + size);
+		return true;
+	}
+};
+
+struct recording_handler : public betabugs::networking::thrift_asio_transport::event_handlers
+{
+	void on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		(void) output_protocol;
+	}
+
+	void on_client_disconnected(const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol, const boost::system::error_code& ec)
+	{
+		(void) output_protocol;
+		(void) ec;
+	}
+
+	void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		(void) output_protocol;
+	}
+
+	void after_process()
+	{
+	}
+};
+
+/// sends payload as a frame compressed with options to a server, that uses the same options
+static std::vector<uint8_t> send_compressed_frame(
+	const betabugs::networking::compression_options& options, const std::vector<uint8_t>& payload, unsigned short port
+)
+{
+	typedef betabugs::networking::thrift_asio_server<recording_handler> server_type;
+
+	boost::asio::io_service io_service;
+	recording_processor processor;
+	auto handler = boost::make_shared<recording_handler>();
+
+	server_type::server_options server_options;
+	server_options.compression = options;
+	server_type::serve(io_service, processor, handler, port, server_options);
+
+	std::vector<uint8_t> frame;
+	betabugs::networking::frame_codec codec(options);
+	BOOST_REQUIRE(codec.compress_frame(payload.data(), uint32_t(payload.size()), frame));
+
+	boost::asio::ip::tcp::socket client(io_service);
+	client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+	boost::asio::write(client, boost::asio::buffer(frame));
+
+	int num_iterations = 5000 / 10;
+	while (processor.frames.empty() && --num_iterations)
+	{
+		io_service.poll();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	BOOST_REQUIRE_EQUAL(processor.frames.size(), 1u);
+	return processor.frames.front();
+}
+
+BOOST_AUTO_TEST_SUITE(test_compression)
+
+BOOST_AUTO_TEST_CASE(test_compression_zlib_round_trip)
+{
+	using betabugs::networking::frame_codec;
+
+	betabugs::networking::compression_options options;
+	options.codec = betabugs::networking::compression_codec::zlib;
+	frame_codec codec(options);
+
+	std::vector<uint8_t> payload(4096);
+	for (size_t i = 0; i < payload.size(); ++i)
+		payload[i] = uint8_t(i % 7);
+
+	BOOST_CHECK(codec.should_compress(payload.size()));
+	BOOST_CHECK(!codec.should_compress(options.min_size - 1));
+
+	std::vector<uint8_t> frame;
+	BOOST_REQUIRE(codec.compress_frame(payload.data(), uint32_t(payload.size()), frame));
+	BOOST_CHECK_LT(frame.size(), payload.size());
+	BOOST_CHECK(frame[0] & 0x80); // compressed_flag
+
+	// the receiving end decompresses, no matter how it is configured itself
+	frame_codec receiver;
+	std::vector<uint8_t> out;
+	const uint8_t* compressed = frame.data() + sizeof(uint32_t);
+	uint32_t compressed_size = uint32_t(frame.size() - sizeof(uint32_t));
+	receiver.decompress_frame(compressed, compressed_size, out);
+	BOOST_CHECK(out == payload);
+
+	// frames, that decompress to more than max_size bytes, are rejected
+	BOOST_CHECK_THROW(
+		receiver.decompress_frame(compressed, compressed_size, out, uint32_t(payload.size() - 1)),
+		apache::thrift::transport::TTransportException
+	);
+
+	// as are corrupted ones
+	frame.back() ^= 0xff;
+	BOOST_CHECK_THROW(
+		receiver.decompress_frame(compressed, compressed_size, out),
+		apache::thrift::transport::TTransportException
+	);
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_max_decompressed_size)
+{
+	using betabugs::networking::frame_codec;
+
+	// a frame, that claims to decompress to 2 GB
+	std::vector<uint8_t> compressed = {uint8_t(betabugs::networking::compression_codec::zlib), 0x80, 0, 0, 0, 0, 0};
+	std::vector<uint8_t> out;
+
+	frame_codec codec;
+	BOOST_CHECK_THROW(
+		codec.decompress_frame(compressed.data(), uint32_t(compressed.size()), out),
+		apache::thrift::transport::TTransportException
+	);
+	BOOST_CHECK(out.empty());
+
+	// the framed transport rejects such a frame, before it is read
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+	boost::asio::ip::tcp::socket peer(io_service);
+	peer.connect(acceptor.local_endpoint());
+	acceptor.accept(*socket);
+
+	betabugs::networking::thrift_asio_transport::event_handlers handlers;
+	auto transport = boost::make_shared<betabugs::networking::thrift_asio_transport>(socket, &handlers);
+	transport->open();
+	betabugs::networking::thrift_asio_framed_transport framed(transport);
+
+	uint8_t header[] = {0xff, 0xff, 0xff, 0xff};
+	boost::asio::write(peer, boost::asio::buffer(header));
+	uint8_t byte = 0;
+	BOOST_CHECK_THROW(framed.read(&byte, 1), apache::thrift::transport::TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_incompressible)
+{
+	betabugs::networking::compression_options options;
+	options.codec = betabugs::networking::compression_codec::zlib;
+	betabugs::networking::frame_codec codec(options);
+
+	// a short payload does not get smaller, so it has to be sent uncompressed
+	std::vector<uint8_t> payload = {1, 2, 3, 4, 5, 6, 7, 8};
+	std::vector<uint8_t> frame;
+	BOOST_CHECK(!codec.compress_frame(payload.data(), uint32_t(payload.size()), frame));
+}
+
+BOOST_AUTO_TEST_CASE(test_compression_server_round_trip)
+{
+	betabugs::networking::compression_options options;
+	options.codec = betabugs::networking::compression_codec::zlib;
+
+	std::vector<uint8_t> payload(4096);
+	for (size_t i = 0; i < payload.size(); ++i)
+		payload[i] = uint8_t(i % 7);
+
+	BOOST_CHECK(send_compressed_frame(options, payload, 1349) == payload);
+}
+
+#ifdef THRIFT_ASIO_WITH_ZSTD
+BOOST_AUTO_TEST_CASE(test_compression_zstd_dictionary)
+{
+	using betabugs::networking::frame_codec;
+
+	std::string words = "thrift asio frame compression dictionary ";
+	auto dictionary = std::make_shared<std::vector<uint8_t>>();
+	for (int i = 0; i < 64; ++i)
+		dictionary->insert(dictionary->end(), words.begin(), words.end());
+
+	betabugs::networking::compression_options options;
+	options.codec = betabugs::networking::compression_codec::zstd;
+	options.dictionary = dictionary;
+
+	std::vector<uint8_t> payload(words.begin(), words.end());
+	payload.insert(payload.end(), words.rbegin(), words.rend());
+	payload.resize(1024, 'x');
+
+	std::vector<uint8_t> frame;
+	frame_codec codec(options);
+	BOOST_REQUIRE(codec.compress_frame(payload.data(), uint32_t(payload.size()), frame));
+	const uint8_t* compressed = frame.data() + sizeof(uint32_t);
+	uint32_t compressed_size = uint32_t(frame.size() - sizeof(uint32_t));
+
+	// only an end with the same dictionary can decompress the frame
+	frame_codec receiver(options);
+	std::vector<uint8_t> out;
+	receiver.decompress_frame(compressed, compressed_size, out);
+	BOOST_CHECK(out == payload);
+
+	frame_codec receiver_without_dictionary;
+	BOOST_CHECK_THROW(
+		receiver_without_dictionary.decompress_frame(compressed, compressed_size, out),
+		apache::thrift::transport::TTransportException
+	);
+
+	// the server decompresses with the dictionary of its options
+	BOOST_CHECK(send_compressed_frame(options, payload, 1350) == payload);
+}
+#endif // THRIFT_ASIO_WITH_ZSTD
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,191 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_connection_management
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_connection_management_mixin.hpp>
+#include <boost/asio/read.hpp>
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// a client, that only remembers its protocol
+struct recorded_client
+{
+	explicit recorded_client(boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol)
+		: protocol(protocol)
+	{
+	}
+
+	/// a oneway call
+	void on_message(int32_t value)
+	{
+		protocol->writeMessageBegin("on_message", apache::thrift::protocol::T_ONEWAY, 0);
+		protocol->writeI32(value);
+		protocol->writeMessageEnd();
+		protocol->getTransport()->writeEnd();
+		protocol->getTransport()->flush();
+	}
+
+	boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol;
+};
+
+class managing_handler : public betabugs::networking::thrift_asio_connection_management_mixin<recorded_client>
+{
+  public:
+	client_ptr current() const
+	{
+		return current_client_;
+	}
+
+	bool is_locked()
+	{
+		if (!clients_mutex_.try_lock())
+			return true;
+		clients_mutex_.unlock();
+		return false;
+	}
+
+	using thrift_asio_connection_management_mixin<recorded_client>::broadcast;
+};
+
+/// a framed protocol, that is connected to a plain socket
+struct connected_protocol
+{
+	explicit connected_protocol(boost::asio::io_service& io_service)
+		: socket(std::make_shared<boost::asio::ip::tcp::socket>(io_service))
+		, peer(io_service)
+	{
+		boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		peer.connect(acceptor.local_endpoint());
+		acceptor.accept(*socket);
+
+		transport = boost::make_shared<betabugs::networking::thrift_asio_transport>(socket, &handlers);
+		protocol = boost::make_shared<apache::thrift::protocol::TBinaryProtocol>(
+			boost::make_shared<betabugs::networking::thrift_asio_framed_transport>(transport)
+		);
+	}
+
+	std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+	boost::asio::ip::tcp::socket peer;
+	betabugs::networking::thrift_asio_transport::event_handlers handlers;
+	boost::shared_ptr<betabugs::networking::thrift_asio_transport> transport;
+	boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol;
+};
+
+static boost::shared_ptr<apache::thrift::protocol::TProtocol> make_protocol()
+{
+	return boost::make_shared<apache::thrift::protocol::TBinaryProtocol>(
+		boost::make_shared<apache::thrift::transport::TMemoryBuffer>()
+	);
+}
+
+BOOST_AUTO_TEST_SUITE(test_connection_management)
+
+BOOST_AUTO_TEST_CASE(test_connection_management_current_client_per_handler)
+{
+	managing_handler a, b;
+	auto protocol_a = make_protocol();
+	auto protocol_b = make_protocol();
+	auto connection_a = a.on_client_connected(protocol_a);
+	auto connection_b = b.on_client_connected(protocol_b);
+	a.after_process();
+	b.after_process();
+
+	// a request of a does not change the current client of b
+	a.before_process(protocol_a, connection_a);
+	BOOST_CHECK(a.current() == connection_a->client);
+	BOOST_CHECK(!b.current());
+
+	b.before_process(protocol_b, connection_b);
+	BOOST_CHECK(a.current() == connection_a->client);
+	BOOST_CHECK(b.current() == connection_b->client);
+
+	// nor is it visible to other threads
+	std::thread([&a]{ BOOST_CHECK(!a.current()); }).join();
+
+	a.after_process();
+	BOOST_CHECK(!a.current());
+	BOOST_CHECK(b.current() == connection_b->client);
+	b.after_process();
+
+	b.on_client_disconnected(protocol_b, boost::system::error_code(), connection_b);
+	a.on_client_disconnected(protocol_a, boost::system::error_code(), connection_a);
+}
+
+BOOST_AUTO_TEST_CASE(test_connection_management_current_client_of_destroyed_handler)
+{
+	// a handler, that is destroyed by another thread, while this thread still has its current client
+	std::aligned_storage<sizeof(managing_handler), alignof(managing_handler)>::type storage;
+	auto first = new (&storage) managing_handler;
+	auto protocol = make_protocol();
+	auto connection = first->on_client_connected(protocol);
+	BOOST_CHECK(first->current() == connection->client);
+	first->on_client_disconnected(protocol, boost::system::error_code(), connection);
+	std::thread([first]{ first->~managing_handler(); }).join();
+
+	// does not pass it on to the next handler at the same address
+	auto second = new (&storage) managing_handler;
+	BOOST_CHECK(!second->current());
+	BOOST_CHECK_EQUAL(connection->client.use_count(), 2);
+
+	// whose first request drops it
+	auto second_connection = second->on_client_connected(make_protocol());
+	BOOST_CHECK(second->current() == second_connection->client);
+	BOOST_CHECK_EQUAL(connection->client.use_count(), 1);
+	second->after_process();
+	second->~managing_handler();
+}
+
+BOOST_AUTO_TEST_CASE(test_connection_management_broadcast)
+{
+	boost::asio::io_service io_service;
+	managing_handler handler;
+
+	std::vector<std::unique_ptr<connected_protocol>> connections;
+	std::vector<managing_handler::connection_ptr> registrations;
+	for (int i = 0; i < 3; ++i)
+	{
+		connections.emplace_back(new connected_protocol(io_service));
+		registrations.push_back(handler.on_client_connected(connections.back()->protocol));
+	}
+	handler.after_process();
+
+	// the call is serialized once, without holding clients_mutex_
+	int num_calls = 0;
+	handler.broadcast([&](recorded_client& client)
+	{
+		++num_calls;
+		BOOST_CHECK(!handler.is_locked());
+		client.on_message(42);
+	}, registrations[0]->client);
+	BOOST_CHECK_EQUAL(num_calls, 1);
+
+	while (connections[1]->transport->outbound_bytes() != 0 || connections[2]->transport->outbound_bytes() != 0)
+		io_service.run_one();
+	BOOST_CHECK_EQUAL(connections[0]->transport->outbound_bytes(), 0u);
+
+	// every other client received the same frame
+	std::vector<uint8_t> frames[2];
+	for (size_t i = 0; i < 2; ++i)
+	{
+		uint8_t header[4];
+		boost::asio::read(connections[i + 1]->peer, boost::asio::buffer(header));
+		uint32_t frame_size = uint32_t(header[0]) << 24 | uint32_t(header[1]) << 16 | uint32_t(header[2]) << 8 | header[3];
+		frames[i].resize(frame_size);
+		boost::asio::read(connections[i + 1]->peer, boost::asio::buffer(frames[i]));
+	}
+	BOOST_CHECK(!frames[0].empty());
+	BOOST_CHECK(frames[0] == frames[1]);
+
+	for (size_t i = 0; i < connections.size(); ++i)
+		handler.on_client_disconnected(connections[i]->protocol, boost::system::error_code(), registrations[i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,80 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_framed_transport
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_framed_transport.hpp>
+#include <boost/asio/write.hpp>
+#include <string>
+
+BOOST_AUTO_TEST_SUITE(test_framed_transport)
+
+using betabugs::networking::thrift_asio_framed_transport;
+using betabugs::networking::thrift_asio_transport;
+
+/// the size prefix of a frame
+static std::string frame_header(uint32_t frame_size)
+{
+	std::string header(sizeof(uint32_t), '\0');
+	header[0] = char(frame_size >> 24);
+	header[1] = char(frame_size >> 16);
+	header[2] = char(frame_size >> 8);
+	header[3] = char(frame_size);
+	return header;
+}
+
+BOOST_AUTO_TEST_CASE(test_framed_transport_read_frames)
+{
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+	boost::asio::ip::tcp::socket peer(io_service);
+	peer.connect(acceptor.local_endpoint());
+	acceptor.accept(*socket);
+
+	thrift_asio_transport::event_handlers handlers;
+	auto transport = boost::make_shared<thrift_asio_transport>(socket, &handlers);
+	transport->open();
+	thrift_asio_framed_transport framed(transport);
+
+	auto send = [&](const std::string& bytes)
+	{
+		auto expected = transport->available_bytes() + bytes.size();
+		boost::asio::write(peer, boost::asio::buffer(bytes));
+		while (transport->available_bytes() < expected)
+			io_service.run_one();
+	};
+
+	// an empty frame is skipped, the next one is not complete yet
+	send(frame_header(0) + frame_header(8) + "012");
+	BOOST_CHECK(!framed.has_complete_frame());
+	BOOST_CHECK_EQUAL(transport->available_bytes(), sizeof(uint32_t) + 3);
+
+	send("34567" + frame_header(4) + "abcd");
+	BOOST_CHECK(framed.has_complete_frame());
+
+	// begin_frame returns the unread size of the current frame
+	BOOST_CHECK_EQUAL(framed.begin_frame(), 8u);
+	uint8_t buffer[8] = {};
+	BOOST_CHECK_EQUAL(framed.read(buffer, 2), 2u);
+	BOOST_CHECK_EQUAL(std::string(reinterpret_cast<char*>(buffer), 2), "01");
+	BOOST_CHECK(framed.has_complete_frame());
+	BOOST_CHECK_EQUAL(framed.begin_frame(), 6u);
+
+	// readEnd skips the unread tail, so the next frame is read from its start
+	BOOST_CHECK_EQUAL(framed.readEnd(), 8u);
+	BOOST_CHECK_EQUAL(transport->available_bytes(), sizeof(uint32_t) + 4);
+	BOOST_CHECK(framed.has_complete_frame());
+	BOOST_CHECK_EQUAL(framed.begin_frame(), 4u);
+	BOOST_CHECK_EQUAL(framed.read(buffer, sizeof(buffer)), 4u);
+	BOOST_CHECK_EQUAL(std::string(reinterpret_cast<char*>(buffer), 4), "abcd");
+	BOOST_CHECK_EQUAL(framed.readEnd(), 4u);
+	BOOST_CHECK(!framed.has_complete_frame());
+
+	transport->close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
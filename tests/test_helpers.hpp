@@ -0,0 +1,32 @@
+#ifndef _THRIFT_ASIO_TEST_HELPERS_HPP_
+#define _THRIFT_ASIO_TEST_HELPERS_HPP_
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+/// polls condition for up to 5 seconds, returns whether it became true
+template <typename Condition>
+static bool wait_for(Condition condition)
+{
+	for (int i = 0; i < 500 && !condition(); ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	return condition();
+}
+
+/// polls condition for duration, returns whether it stayed true
+template <typename Condition>
+static bool holds_for(std::chrono::milliseconds duration, Condition condition)
+{
+	const auto end = std::chrono::steady_clock::now() + duration;
+	while (condition())
+	{
+		if (std::chrono::steady_clock::now() >= end)
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	return false;
+}
+
+#endif //_THRIFT_ASIO_TEST_HELPERS_HPP_
@@ -0,0 +1,139 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_log
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_log.hpp>
+#include <boost/asio/error.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+
+#ifndef THRIFT_ASIO_NO_LOGGING
+
+/// a string buffer, that blocks writers while it is closed, to park the thread of an async_logger
+class gated_buffer : public std::stringbuf
+{
+  public:
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_open_ = false;
+	}
+
+	void open()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_open_ = true;
+		changed_.notify_all();
+	}
+
+	/// blocks, until a writer waits for the buffer to be opened
+	void wait_for_writer()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		changed_.wait(lock, [this]{ return is_writer_waiting_; });
+	}
+
+  protected:
+	virtual std::streamsize xsputn(const char* s, std::streamsize n) override
+	{
+		pass();
+		return std::stringbuf::xsputn(s, n);
+	}
+
+	virtual int_type overflow(int_type c) override
+	{
+		pass();
+		return std::stringbuf::overflow(c);
+	}
+
+  private:
+	std::mutex mutex_;
+	std::condition_variable changed_;
+	bool is_open_ = true;
+	bool is_writer_waiting_ = false;
+
+	void pass()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (is_open_)
+			return;
+
+		is_writer_waiting_ = true;
+		changed_.notify_all();
+		changed_.wait(lock, [this]{ return is_open_; });
+		is_writer_waiting_ = false;
+	}
+};
+
+BOOST_AUTO_TEST_SUITE(test_log)
+
+BOOST_AUTO_TEST_CASE(test_log_async_logger)
+{
+	using namespace betabugs::networking;
+
+	gated_buffer buffer;
+	std::ostream out(&buffer);
+	{
+		async_logger logger(out, 4);
+		set_logger(&logger);
+
+		log_message(log_level::debug, "below the level");
+		log_message(log_level::warning, "frame exceeds max_frame_size", {{"frame_size", 1024}, {"peer", "127.0.0.1"}});
+		log_message(log_level::info, "client disconnected", {{"error", boost::asio::error::connection_reset}});
+		logger.flush();
+		BOOST_CHECK_EQUAL(logger.num_dropped(), 0u);
+
+		// park the logger's thread, while it writes a record, that still occupies its slot
+		buffer.close();
+		log_message(log_level::info, "parked");
+		buffer.wait_for_writer();
+
+		// so the ring buffer of 4 records has room for 3 more, the others are dropped
+		for (int i = 0; i < 1000; ++i)
+			log_message(log_level::info, "flood");
+		BOOST_CHECK_EQUAL(logger.num_dropped(), 997u);
+
+		buffer.open();
+		set_logger(nullptr);
+	}
+
+	auto text = buffer.str();
+	BOOST_CHECK(text.find("below the level") == std::string::npos);
+	BOOST_CHECK(text.find(" warning frame exceeds max_frame_size frame_size=1024 peer=\"127.0.0.1\"\n") != std::string::npos);
+	BOOST_CHECK(text.find(" info client disconnected error=\"") != std::string::npos);
+	BOOST_CHECK(text.find("dropped 997 log messages\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(test_log_filtered_fields)
+{
+	using namespace betabugs::networking;
+
+	std::ostringstream out;
+	async_logger logger(out);
+	logger.set_level(log_level::warning);
+	set_logger(&logger);
+
+	int num_built = 0;
+	auto field = [&num_built]{ return ++num_built; };
+
+	// the fields of a message below the level are not built
+	THRIFT_ASIO_LOG(log_level::info, "below the level", {{"value", field()}});
+	BOOST_CHECK_EQUAL(num_built, 0);
+
+	THRIFT_ASIO_LOG(log_level::warning, "logged", {{"value", field()}});
+	BOOST_CHECK_EQUAL(num_built, 1);
+
+	logger.flush();
+	set_logger(nullptr);
+	BOOST_CHECK(out.str().find("below the level") == std::string::npos);
+	BOOST_CHECK(out.str().find(" warning logged value=1\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
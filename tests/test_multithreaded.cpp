@@ -0,0 +1,149 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_multithreaded
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <iostream>
+#include <thrift/protocol/TBinaryProtocol.h>
+
+#include <asynchronous_server.h>
+#include <asynchronous_client.h>
+#include <betabugs/networking/thrift_asio_transport.hpp>
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <betabugs/networking/thrift_asio_client_transport.hpp>
+#include <betabugs/networking/thrift_asio_client.hpp>
+#include <betabugs/networking/thrift_asio_connection_management_mixin.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+class multithreaded_server_handler : public test::asynchronous_serverIf
+									, public betabugs::networking::thrift_asio_transport::event_handlers
+									, public betabugs::networking::thrift_asio_connection_management_mixin<test::asynchronous_clientClient>
+{
+  public:
+	std::atomic<int> num_calls{0};
+
+	virtual void add(const int32_t a, const int32_t b) override
+	{
+		assert(current_client_);
+		++num_calls;
+		current_client_->on_added(a + b);
+	}
+};
+
+
+class multithreaded_client_handler : public betabugs::networking::thrift_asio_client<
+	test::asynchronous_serverClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	multithreaded_client_handler(
+		boost::asio::io_service& io_service,
+		const std::string& host_name,
+		const std::string& service_name,
+		int32_t argument
+	)
+		: thrift_asio_client(io_service, host_name, service_name)
+		, argument(argument)
+	{
+	}
+
+	const int32_t argument;
+	const int num_requests = 100;
+	int num_results = 0;
+	bool all_results_correct = true;
+
+	virtual void on_added(const int32_t result) override
+	{
+		all_results_correct = all_results_correct && result == 2 * argument;
+		++num_results;
+	}
+
+	virtual void on_connected() override
+	{
+		for (int i = 0; i < num_requests; ++i)
+			client_.add(argument, argument);
+	}
+};
+
+
+BOOST_AUTO_TEST_SUITE(test_multithreaded)
+
+BOOST_AUTO_TEST_CASE(test_multithreaded_server)
+{
+	const unsigned short port = 1339;
+	const int num_clients = 8;
+	const int num_threads = 4;
+
+	// create the server, and run it on multiple threads. The io_service outlives the handler,
+	// whose clients hold the sockets of the connections.
+	boost::asio::io_service server_io_service;
+	auto handler = boost::make_shared<multithreaded_server_handler>();
+	auto processor = test::asynchronous_serverProcessor{handler};
+
+	std::unique_ptr<boost::asio::io_service::work> server_work(
+		new boost::asio::io_service::work(server_io_service)
+	);
+
+	betabugs::networking::thrift_asio_server<multithreaded_server_handler>::serve(
+		server_io_service, processor, handler, port
+	);
+
+	std::vector<std::thread> server_threads;
+	for (int i = 0; i < num_threads; ++i)
+		server_threads.emplace_back([&server_io_service]{ server_io_service.run(); });
+
+	// create the clients
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	std::vector<std::unique_ptr<multithreaded_client_handler>> clients;
+	for (int i = 0; i < num_clients; ++i)
+	{
+		clients.emplace_back(
+			new multithreaded_client_handler(io_service, "127.0.0.1", std::to_string(port), i + 1)
+		);
+	}
+
+	auto all_done = [&clients]
+	{
+		for (auto& client : clients)
+			if (client->num_results < client->num_requests)
+				return false;
+		return true;
+	};
+
+	int num_iterations = 5000 / 10;
+	while (--num_iterations && !all_done())
+	{
+		while (io_service.poll_one())
+		{
+			for (auto& client : clients)
+				client->update();
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+
+	for (auto& client : clients)
+	{
+		BOOST_CHECK_EQUAL(client->num_results, client->num_requests);
+		BOOST_CHECK(client->all_results_correct);
+	}
+	BOOST_CHECK_EQUAL(handler->num_calls.load(), num_clients * 100);
+
+	server_work.reset();
+	server_io_service.stop();
+	for (auto& thread : server_threads)
+		thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
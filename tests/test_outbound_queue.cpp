@@ -0,0 +1,98 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_outbound_queue
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_transport.hpp>
+#include <boost/asio/read.hpp>
+#include <string>
+
+BOOST_AUTO_TEST_SUITE(test_outbound_queue)
+
+using betabugs::networking::thrift_asio_transport;
+
+// a transport, that is connected to a plain socket
+struct connected_transport
+{
+	explicit connected_transport(const thrift_asio_transport::outbound_queue_options& options)
+		: acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+		, socket(std::make_shared<boost::asio::ip::tcp::socket>(io_service))
+		, peer(io_service)
+	{
+		peer.connect(acceptor.local_endpoint());
+		acceptor.accept(*socket);
+		transport = boost::make_shared<thrift_asio_transport>(
+			socket, &handlers, thrift_asio_transport::receive_buffer_options(), options
+		);
+	}
+
+	void write(const std::string& message)
+	{
+		transport->write(reinterpret_cast<const uint8_t*>(message.data()), uint32_t(message.size()));
+	}
+
+	std::string receive(size_t len)
+	{
+		while (transport->outbound_bytes() != 0)
+			io_service.run_one();
+
+		std::string result(len, '\0');
+		boost::asio::read(peer, boost::asio::buffer(&result[0], len));
+		return result;
+	}
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor;
+	std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+	boost::asio::ip::tcp::socket peer;
+	thrift_asio_transport::event_handlers handlers;
+	boost::shared_ptr<thrift_asio_transport> transport;
+};
+
+BOOST_AUTO_TEST_CASE(test_outbound_queue_drop_newest)
+{
+	thrift_asio_transport::outbound_queue_options options;
+	options.max_messages = 2;
+	options.policy = thrift_asio_transport::overflow_policy::drop_newest;
+	connected_transport c(options);
+
+	// nothing is sent, until the io_service is run
+	c.write("aaaa");
+	c.write("bbbb");
+	c.write("cccc");
+	c.write("dddd");
+
+	auto stats = c.transport->outbound_stats();
+	BOOST_CHECK_EQUAL(stats.queued_messages, 2u);
+	BOOST_CHECK_EQUAL(stats.queued_bytes, 8u);
+	BOOST_CHECK_EQUAL(stats.overflow_count, 2u);
+	BOOST_CHECK_EQUAL(stats.dropped_messages, 2u);
+	BOOST_CHECK_EQUAL(stats.dropped_bytes, 8u);
+
+	BOOST_CHECK_EQUAL(c.receive(8), "aaaabbbb");
+}
+
+BOOST_AUTO_TEST_CASE(test_outbound_queue_drop_oldest)
+{
+	thrift_asio_transport::outbound_queue_options options;
+	options.max_bytes = 8;
+	options.policy = thrift_asio_transport::overflow_policy::drop_oldest;
+	connected_transport c(options);
+
+	c.write("aaaa");
+	c.write("bbbb");
+	c.write("cccc");
+
+	auto stats = c.transport->outbound_stats();
+	BOOST_CHECK_EQUAL(stats.queued_bytes, 8u);
+	BOOST_CHECK_EQUAL(stats.peak_queued_bytes, 8u);
+	BOOST_CHECK_EQUAL(stats.dropped_messages, 1u);
+
+	BOOST_CHECK_EQUAL(c.receive(8), "bbbbcccc");
+	BOOST_CHECK_EQUAL(c.transport->outbound_stats().queued_bytes, 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
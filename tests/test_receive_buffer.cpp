@@ -0,0 +1,108 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_receive_buffer
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_transport.hpp>
+#include <boost/asio/write.hpp>
+#include <string>
+
+BOOST_AUTO_TEST_SUITE(test_receive_buffer)
+
+using betabugs::networking::thrift_asio_transport;
+
+static thrift_asio_transport::receive_buffer_options adaptive_options()
+{
+	thrift_asio_transport::receive_buffer_options options;
+	options.initial_size = 16;
+	options.min_size = 16;
+	options.max_size = 64;
+	options.adaptive = true;
+	options.grow_after = 2;
+	options.shrink_after = 2;
+	return options;
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_buffer_sizer)
+{
+	thrift_asio_transport::receive_buffer_sizer sizer(adaptive_options());
+	BOOST_CHECK_EQUAL(sizer.size(), 16u);
+
+	// full receives grow the size up to max_size
+	for (int i = 0; i < 8; ++i)
+		BOOST_CHECK(!sizer.on_receive(sizer.size()));
+	BOOST_CHECK_EQUAL(sizer.size(), 64u);
+	BOOST_CHECK_EQUAL(sizer.grow_count(), 2u);
+
+	// small receives shrink it down to min_size
+	BOOST_CHECK(!sizer.on_receive(1));
+	BOOST_CHECK(sizer.on_receive(1));
+	BOOST_CHECK_EQUAL(sizer.size(), 32u);
+	for (int i = 0; i < 8; ++i)
+		sizer.on_receive(1);
+	BOOST_CHECK_EQUAL(sizer.size(), 16u);
+	BOOST_CHECK_EQUAL(sizer.shrink_count(), 2u);
+
+	// receives in between reset the counting
+	sizer.on_receive(16);
+	sizer.on_receive(8);
+	sizer.on_receive(16);
+	BOOST_CHECK_EQUAL(sizer.size(), 16u);
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_buffer_not_adaptive)
+{
+	auto options = adaptive_options();
+	options.adaptive = false;
+
+	thrift_asio_transport::receive_buffer_sizer sizer(options);
+	for (int i = 0; i < 8; ++i)
+		BOOST_CHECK(!sizer.on_receive(sizer.size()));
+	for (int i = 0; i < 8; ++i)
+		BOOST_CHECK(!sizer.on_receive(1));
+	BOOST_CHECK_EQUAL(sizer.size(), 16u);
+	BOOST_CHECK_EQUAL(sizer.grow_count(), 0u);
+	BOOST_CHECK_EQUAL(sizer.shrink_count(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_receive_buffer_adaptive_transport)
+{
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+	boost::asio::ip::tcp::socket peer(io_service);
+	peer.connect(acceptor.local_endpoint());
+	acceptor.accept(*socket);
+
+	thrift_asio_transport::event_handlers handlers;
+	auto transport = boost::make_shared<thrift_asio_transport>(socket, &handlers, adaptive_options());
+	transport->open();
+
+	// a burst is received in full chunks
+	std::string burst(1024, 'x');
+	boost::asio::write(peer, boost::asio::buffer(burst));
+	std::string received(burst.size(), '\0');
+	transport->read(reinterpret_cast<uint8_t*>(&received[0]), uint32_t(received.size()));
+	BOOST_CHECK(received == burst);
+	BOOST_CHECK_EQUAL(transport->receive_stats().buffer_size, 64u);
+	BOOST_CHECK_GT(transport->receive_stats().grow_count, 0u);
+
+	// single bytes are small receives
+	for (int i = 0; i < 8; ++i)
+	{
+		boost::asio::write(peer, boost::asio::buffer("y", 1));
+		uint8_t byte = 0;
+		transport->read(&byte, 1);
+		BOOST_CHECK_EQUAL(byte, 'y');
+	}
+	BOOST_CHECK_EQUAL(transport->receive_stats().buffer_size, 16u);
+	BOOST_CHECK_GT(transport->receive_stats().shrink_count, 0u);
+	BOOST_CHECK_LE(transport->receive_stats().buffer_capacity, 64u);
+
+	transport->close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
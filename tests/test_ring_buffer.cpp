@@ -0,0 +1,102 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_ring_buffer
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/ring_buffer.hpp>
+#include <numeric>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(test_ring_buffer)
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_wrap_around)
+{
+	betabugs::networking::ring_buffer buffer(16);
+	BOOST_CHECK_EQUAL(buffer.capacity(), 16u);
+
+	std::vector<uint8_t> bytes(12);
+	std::iota(bytes.begin(), bytes.end(), 0);
+
+	// move the head to the middle, so that the next append wraps around
+	buffer.append(bytes.data(), 10);
+	std::vector<uint8_t> out(12);
+	BOOST_CHECK_EQUAL(buffer.read(out.data(), 8), 8u);
+
+	buffer.append(bytes.data(), 12);
+	BOOST_CHECK_EQUAL(buffer.size(), 14u);
+	BOOST_CHECK_EQUAL(buffer.capacity(), 16u);
+
+	size_t contiguous_bytes = 0;
+	buffer.data(&contiguous_bytes);
+	BOOST_CHECK_EQUAL(contiguous_bytes, 8u);
+
+	buffer.consume(2);
+	BOOST_CHECK_EQUAL(buffer.read(out.data(), out.size()), 12u);
+	BOOST_CHECK(out == bytes);
+	BOOST_CHECK(buffer.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_grow)
+{
+	betabugs::networking::ring_buffer buffer(4);
+
+	std::vector<uint8_t> bytes(100);
+	std::iota(bytes.begin(), bytes.end(), 0);
+
+	buffer.append(bytes.data(), 3);
+	buffer.consume(2);
+	buffer.append(bytes.data() + 3, bytes.size() - 3);
+	BOOST_CHECK_GE(buffer.capacity(), 98u);
+
+	std::vector<uint8_t> out(98);
+	BOOST_CHECK_EQUAL(buffer.read(out.data(), out.size()), 98u);
+	BOOST_CHECK(std::equal(out.begin(), out.end(), bytes.begin() + 2));
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_prepare_commit)
+{
+	betabugs::networking::ring_buffer buffer(8);
+	const uint8_t bytes[] = {1, 2, 3, 4, 5, 6};
+	buffer.append(bytes, 6);
+	buffer.consume(4);
+
+	auto spans = buffer.prepare(buffer.free_space());
+	BOOST_CHECK_EQUAL(boost::asio::buffer_size(spans[0]), 2u);
+	BOOST_CHECK_EQUAL(boost::asio::buffer_size(spans[1]), 4u);
+
+	auto n = boost::asio::buffer_copy(spans, boost::asio::buffer(bytes));
+	buffer.commit(n);
+	BOOST_CHECK_EQUAL(buffer.size(), 8u);
+
+	uint8_t out[8];
+	buffer.read(out, 8);
+	const uint8_t expected[] = {5, 6, 1, 2, 3, 4, 5, 6};
+	BOOST_CHECK(std::equal(out, out + 8, expected));
+}
+
+BOOST_AUTO_TEST_CASE(test_ring_buffer_consume_to_empty_while_prepared)
+{
+	betabugs::networking::ring_buffer buffer(8);
+	const uint8_t bytes[] = {1, 2, 3, 4, 5, 6};
+	buffer.append(bytes, 6);
+
+	// a receive into the free space is pending, while the readable bytes are consumed
+	auto spans = buffer.prepare(buffer.free_space());
+	buffer.consume(6);
+	BOOST_CHECK(buffer.empty());
+
+	// the received bytes have to show up at the head, not behind it
+	const uint8_t received[] = {7, 8};
+	auto n = boost::asio::buffer_copy(spans, boost::asio::buffer(received));
+	buffer.commit(n);
+
+	uint8_t out[2] = {0, 0};
+	BOOST_CHECK_EQUAL(buffer.read(out, 2), 2u);
+	BOOST_CHECK_EQUAL(out[0], 7);
+	BOOST_CHECK_EQUAL(out[1], 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,246 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_server_limits
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "test_helpers.hpp"
+
+/// counts the connections
+struct limited_handler : public betabugs::networking::thrift_asio_transport::event_handlers
+{
+	void on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol>)
+	{
+		++num_connected;
+	}
+
+	void on_client_disconnected(const boost::shared_ptr<apache::thrift::protocol::TProtocol>&, const boost::system::error_code& ec)
+	{
+		last_error = ec;
+		++num_disconnected;
+	}
+
+	void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol>)
+	{
+	}
+
+	void after_process()
+	{
+	}
+
+	std::atomic<int> num_connected{0};
+	std::atomic<int> num_disconnected{0};
+	boost::system::error_code last_error;
+};
+
+/// answers every frame with reply_size bytes
+struct replying_processor : public apache::thrift::TProcessor
+{
+	explicit replying_processor(size_t reply_size)
+		: reply(reply_size, 'x')
+	{
+	}
+
+	virtual bool process(
+		boost::shared_ptr<apache::thrift::protocol::TProtocol>,
+		boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol,
+		void*
+	) override
+	{
+		++num_calls;
+		if (!reply.empty())
+		{
+			auto transport = output_protocol->getTransport();
+			transport->write(reinterpret_cast<const uint8_t*>(reply.data()), uint32_t(reply.size()));
+			transport->writeEnd();
+			transport->flush();
+		}
+		return true;
+	}
+
+	const std::string reply;
+	std::atomic<int> num_calls{0};
+};
+
+/// runs the server's io_service on its own thread, so that the test can use blocking sockets
+struct server_thread
+{
+	server_thread()
+		: work(new boost::asio::io_service::work(io_service))
+		, thread([this]{ io_service.run(); })
+	{
+	}
+
+	~server_thread()
+	{
+		work.reset();
+		io_service.stop();
+		thread.join();
+	}
+
+	boost::asio::io_service io_service;
+	std::unique_ptr<boost::asio::io_service::work> work;
+	std::thread thread;
+};
+
+/// a frame with the given header and payload_size bytes of payload
+static std::vector<uint8_t> make_frame(uint32_t frame_size, size_t payload_size)
+{
+	std::vector<uint8_t> frame(sizeof(uint32_t) + payload_size, 0);
+	frame[0] = uint8_t(frame_size >> 24);
+	frame[1] = uint8_t(frame_size >> 16);
+	frame[2] = uint8_t(frame_size >> 8);
+	frame[3] = uint8_t(frame_size);
+	return frame;
+}
+
+BOOST_AUTO_TEST_SUITE(test_server_limits)
+
+typedef betabugs::networking::thrift_asio_server<limited_handler> limited_server;
+
+BOOST_AUTO_TEST_CASE(test_server_limits_max_connections)
+{
+	const unsigned short port = 1354;
+	auto handler = boost::make_shared<limited_handler>();
+	replying_processor processor(0);
+
+	server_thread server;
+	limited_server::server_options options;
+	options.max_connections = 2;
+	auto acceptor = limited_server::serve(server.io_service, processor, handler, port, options);
+
+	boost::asio::io_service io_service;
+	const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+	std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> clients;
+	for (int i = 0; i < 3; ++i)
+	{
+		clients.emplace_back(new boost::asio::ip::tcp::socket(io_service));
+		clients.back()->connect(endpoint);
+	}
+
+	// the third client waits in the backlog
+	BOOST_CHECK(wait_for([&handler]{ return handler->num_connected == 2; }));
+	BOOST_CHECK(holds_for(std::chrono::milliseconds(50), [&handler]{ return handler->num_connected == 2; }));
+
+	// and is accepted, once another one is gone
+	clients[0]->close();
+	BOOST_CHECK(wait_for([&handler]{ return handler->num_connected == 3; }));
+	BOOST_CHECK_EQUAL(handler->num_disconnected.load(), 1);
+
+	server.io_service.post([acceptor]{ acceptor->close(); });
+}
+
+BOOST_AUTO_TEST_CASE(test_server_limits_max_frame_size)
+{
+	const unsigned short port = 1355;
+	auto handler = boost::make_shared<limited_handler>();
+	replying_processor processor(0);
+
+	server_thread server;
+	limited_server::server_options options;
+	options.max_frame_size = 100;
+	auto acceptor = limited_server::serve(server.io_service, processor, handler, port, options);
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::socket client(io_service);
+	client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+
+	// a frame within the limit is processed
+	boost::asio::write(client, boost::asio::buffer(make_frame(100, 100)));
+	BOOST_CHECK(wait_for([&processor]{ return processor.num_calls == 1; }));
+
+	// a bigger one drops the connection, before its payload is sent
+	boost::asio::write(client, boost::asio::buffer(make_frame(1u << 30, 0)));
+	BOOST_CHECK(wait_for([&handler]{ return handler->num_disconnected == 1; }));
+	BOOST_CHECK(handler->last_error == boost::asio::error::message_size);
+	BOOST_CHECK_EQUAL(processor.num_calls.load(), 1);
+
+	server.io_service.post([acceptor]{ acceptor->close(); });
+}
+
+BOOST_AUTO_TEST_CASE(test_server_limits_outbound_high_water_mark)
+{
+	const unsigned short port = 1356;
+	const size_t reply_size = 8 << 20;
+	auto handler = boost::make_shared<limited_handler>();
+	replying_processor processor(reply_size);
+
+	server_thread server;
+	limited_server::server_options options;
+	options.outbound_high_water_mark = 1024;
+	options.compression.codec = betabugs::networking::compression_codec::none;
+	auto acceptor = limited_server::serve(server.io_service, processor, handler, port, options);
+
+	// a small receive window, so that the reply stays queued at the server
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::socket client(io_service);
+	client.open(boost::asio::ip::tcp::v4());
+	client.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+	client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+
+	boost::asio::write(client, boost::asio::buffer(make_frame(1, 1)));
+	BOOST_CHECK(wait_for([&processor]{ return processor.num_calls == 1; }));
+
+	// while the reply is not read, the next request is not
+	boost::asio::write(client, boost::asio::buffer(make_frame(1, 1)));
+	BOOST_CHECK(holds_for(std::chrono::milliseconds(100), [&processor]{ return processor.num_calls == 1; }));
+
+	// reading the reply resumes reading requests
+	std::vector<uint8_t> reply(sizeof(uint32_t) + reply_size);
+	boost::asio::read(client, boost::asio::buffer(reply));
+	BOOST_CHECK(wait_for([&processor]{ return processor.num_calls == 2; }));
+
+	boost::asio::read(client, boost::asio::buffer(reply));
+	server.io_service.post([acceptor]{ acceptor->close(); });
+}
+
+BOOST_AUTO_TEST_CASE(test_server_limits_out_of_file_descriptors)
+{
+	const unsigned short port = 1359;
+	auto handler = boost::make_shared<limited_handler>();
+	replying_processor processor(0);
+
+	server_thread server;
+	limited_server::server_options options;
+	options.accept_retry_delay = boost::posix_time::milliseconds(20);
+	auto acceptor = limited_server::serve(server.io_service, processor, handler, port, options);
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::socket client(io_service);
+	client.open(boost::asio::ip::tcp::v4());
+
+	// use up the file descriptors, so that the server fails to accept the client
+	rlimit original;
+	BOOST_REQUIRE_EQUAL(getrlimit(RLIMIT_NOFILE, &original), 0);
+	std::vector<int> descriptors(1, dup(0));
+	rlimit limited = original;
+	limited.rlim_cur = rlim_t(descriptors.back() + 16);
+	BOOST_REQUIRE_EQUAL(setrlimit(RLIMIT_NOFILE, &limited), 0);
+	for (int fd = dup(0); fd >= 0; fd = dup(0))
+		descriptors.push_back(fd);
+
+	client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+	BOOST_CHECK(holds_for(std::chrono::milliseconds(100), [&handler]{ return handler->num_connected == 0; }));
+
+	// the server keeps accepting, once there are descriptors again
+	for (int fd : descriptors)
+		close(fd);
+	setrlimit(RLIMIT_NOFILE, &original);
+	BOOST_CHECK(wait_for([&handler]{ return handler->num_connected == 1; }));
+
+	server.io_service.post([acceptor]{ acceptor->close(); });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
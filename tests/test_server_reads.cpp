@@ -0,0 +1,249 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_server_reads
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "test_helpers.hpp"
+
+/// remembers the output protocol of each connection
+struct reads_handler : public betabugs::networking::thrift_asio_transport::event_handlers
+{
+	typedef boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol_ptr;
+
+	void on_client_connected(protocol_ptr output_protocol)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		connections.push_back(output_protocol);
+	}
+
+	void on_client_disconnected(const protocol_ptr&, const boost::system::error_code&)
+	{
+	}
+
+	void before_process(protocol_ptr)
+	{
+	}
+
+	void after_process()
+	{
+	}
+
+	protocol_ptr connection(size_t i)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return connections.at(i);
+	}
+
+	std::mutex mutex;
+	std::vector<protocol_ptr> connections;
+};
+
+/// answers a frame, that holds a number, with the same number
+struct echo_processor : public apache::thrift::TProcessor
+{
+	virtual bool process(
+		boost::shared_ptr<apache::thrift::protocol::TProtocol> input_protocol,
+		boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol,
+		void*
+	) override
+	{
+		int32_t value = 0;
+		input_protocol->readI32(value);
+
+		output_protocol->writeI32(value);
+		output_protocol->getTransport()->writeEnd();
+		output_protocol->getTransport()->flush();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			input_protocols.insert(input_protocol.get());
+			input_transports.insert(input_protocol->getTransport().get());
+		}
+		++num_calls;
+		return true;
+	}
+
+	std::atomic<int> num_calls{0};
+
+	std::mutex mutex;
+	std::set<apache::thrift::protocol::TProtocol*> input_protocols; ///< the distinct ones, that frames were decoded with
+	std::set<apache::thrift::transport::TTransport*> input_transports;
+};
+
+/// runs the server's io_service on its own thread, so that the test can use blocking sockets
+struct reads_server_thread
+{
+	reads_server_thread()
+		: work(new boost::asio::io_service::work(io_service))
+		, thread([this]{ io_service.run(); })
+	{
+	}
+
+	~reads_server_thread()
+	{
+		work.reset();
+		io_service.stop();
+		thread.join();
+	}
+
+	boost::asio::io_service io_service;
+	std::unique_ptr<boost::asio::io_service::work> work;
+	std::thread thread;
+};
+
+/// frames, that each hold one of the numbers in order, as they are sent by a client
+static std::vector<uint8_t> make_echo_frames(int32_t count)
+{
+	std::vector<uint8_t> bytes;
+	for (int32_t i = 0; i < count; ++i)
+	{
+		const uint8_t frame[] = {
+			0, 0, 0, 4,
+			uint8_t(i >> 24), uint8_t(i >> 16), uint8_t(i >> 8), uint8_t(i)
+		};
+		bytes.insert(bytes.end(), frame, frame + sizeof(frame));
+	}
+	return bytes;
+}
+
+BOOST_AUTO_TEST_SUITE(test_server_reads)
+
+typedef betabugs::networking::thrift_asio_server<reads_handler> reads_server;
+
+/// the receive statistics of a connection, read on its strand
+static betabugs::networking::thrift_asio_transport::receive_statistics receive_stats_of(
+	const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol
+)
+{
+	std::promise<betabugs::networking::thrift_asio_transport::receive_statistics> stats;
+	reads_server::post(output_protocol, [&stats, output_protocol]
+	{
+		stats.set_value(reads_server::get_transport(output_protocol)->receive_stats());
+	});
+	return stats.get_future().get();
+}
+
+BOOST_AUTO_TEST_CASE(test_server_reads_receive_buffer_options)
+{
+	const unsigned short port = 1360;
+	const int32_t num_frames = 128;
+	auto handler = boost::make_shared<reads_handler>();
+	echo_processor processor;
+
+	reads_server_thread server;
+	reads_server::server_options options;
+	options.receive_buffer.initial_size = 16;
+	options.receive_buffer.min_size = 16;
+	options.receive_buffer.max_size = 64;
+	options.receive_buffer.adaptive = true;
+	options.receive_buffer.grow_after = 2;
+	auto acceptor = reads_server::serve(server.io_service, processor, handler, port, options);
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::socket client(io_service);
+	client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+
+	// a burst is received in chunks, that grow from initial_size to max_size
+	auto frames = make_echo_frames(num_frames);
+	boost::asio::write(client, boost::asio::buffer(frames));
+	BOOST_CHECK(wait_for([&processor]{ return processor.num_calls == num_frames; }));
+
+	auto stats = receive_stats_of(handler->connection(0));
+	BOOST_CHECK_EQUAL(stats.bytes_received, frames.size());
+	BOOST_CHECK_EQUAL(stats.buffer_size, 64u);
+	BOOST_CHECK_GT(stats.grow_count, 0u);
+	BOOST_CHECK_GE(stats.receive_count, frames.size() / stats.buffer_capacity);
+
+	std::vector<uint8_t> replies(frames.size());
+	boost::asio::read(client, boost::asio::buffer(replies));
+	server.io_service.post([acceptor]{ acceptor->close(); });
+}
+
+BOOST_AUTO_TEST_CASE(test_server_reads_reused_decode_objects)
+{
+	const unsigned short port = 1361;
+	const int32_t num_frames = 3;
+	auto handler = boost::make_shared<reads_handler>();
+	echo_processor processor;
+
+	reads_server_thread server;
+	auto acceptor = reads_server::serve(server.io_service, processor, handler, port);
+
+	boost::asio::io_service io_service;
+	std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> clients;
+	for (int i = 0; i < 2; ++i)
+	{
+		clients.emplace_back(new boost::asio::ip::tcp::socket(io_service));
+		clients.back()->connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+	}
+
+	// the frames are sent one by one, so that each of them is read separately
+	auto frames = make_echo_frames(num_frames);
+	const size_t frame_size = frames.size() / num_frames;
+	int32_t num_sent = 0;
+	for (int32_t i = 0; i < num_frames; ++i)
+	{
+		for (auto& client : clients)
+		{
+			boost::asio::write(*client, boost::asio::buffer(&frames[i * frame_size], frame_size));
+			++num_sent;
+			BOOST_CHECK(wait_for([&processor, num_sent]{ return processor.num_calls == num_sent; }));
+
+			std::vector<uint8_t> reply(frame_size);
+			boost::asio::read(*client, boost::asio::buffer(reply));
+		}
+	}
+
+	// every connection decodes all of its frames with the same objects
+	std::lock_guard<std::mutex> lock(processor.mutex);
+	BOOST_CHECK_EQUAL(processor.input_protocols.size(), clients.size());
+	BOOST_CHECK_EQUAL(processor.input_transports.size(), clients.size());
+
+	server.io_service.post([acceptor]{ acceptor->close(); });
+}
+
+BOOST_AUTO_TEST_CASE(test_server_reads_pipelined_frames)
+{
+	const unsigned short port = 1362;
+	const int32_t num_frames = 1000;
+	auto handler = boost::make_shared<reads_handler>();
+	echo_processor processor;
+
+	reads_server_thread server;
+	auto acceptor = reads_server::serve(server.io_service, processor, handler, port);
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::socket client(io_service);
+	client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+
+	// a burst of frames in one write, so that reads end within frames and hold several of them
+	auto frames = make_echo_frames(num_frames);
+	boost::asio::write(client, boost::asio::buffer(frames));
+
+	// every frame is answered, in the order they were sent
+	std::vector<uint8_t> replies(frames.size());
+	boost::asio::read(client, boost::asio::buffer(replies));
+	BOOST_CHECK(replies == frames);
+	BOOST_CHECK_EQUAL(processor.num_calls.load(), num_frames);
+
+	// and they were read with fewer receives
+	auto stats = receive_stats_of(handler->connection(0));
+	BOOST_CHECK_LT(stats.receive_count, uint64_t(num_frames));
+
+	server.io_service.post([acceptor]{ acceptor->close(); });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
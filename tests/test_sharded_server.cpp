@@ -0,0 +1,136 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_sharded_server
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/io_service_pool.hpp>
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "test_helpers.hpp"
+
+/// remembers the thread, that each connection was accepted on
+struct sharded_handler : public betabugs::networking::thrift_asio_transport::event_handlers
+{
+	typedef boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol_ptr;
+
+	void on_client_connected(protocol_ptr output_protocol)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shards[output_protocol] = std::this_thread::get_id();
+		max_live_connections = std::max(max_live_connections, ++num_live_connections);
+		++num_connected;
+	}
+
+	void on_client_disconnected(const protocol_ptr& output_protocol, const boost::system::error_code&)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shards.erase(output_protocol);
+		--num_live_connections;
+		++num_disconnected;
+	}
+
+	void before_process(protocol_ptr)
+	{
+	}
+
+	void after_process()
+	{
+	}
+
+	std::mutex mutex;
+	std::map<protocol_ptr, std::thread::id> shards;
+	size_t num_live_connections = 0;
+	size_t max_live_connections = 0;
+	std::atomic<size_t> num_connected{0};
+	std::atomic<size_t> num_disconnected{0};
+};
+
+/// ignores every frame
+struct ignoring_processor : public apache::thrift::TProcessor
+{
+	virtual bool process(
+		boost::shared_ptr<apache::thrift::protocol::TProtocol>,
+		boost::shared_ptr<apache::thrift::protocol::TProtocol>,
+		void*
+	) override
+	{
+		return true;
+	}
+};
+
+BOOST_AUTO_TEST_SUITE(test_sharded_server)
+
+BOOST_AUTO_TEST_CASE(test_sharded_server_max_connections)
+{
+	typedef betabugs::networking::thrift_asio_server<sharded_handler> server;
+
+	const unsigned short port = 1353;
+	const size_t num_clients = 6;
+
+	betabugs::networking::io_service_pool pool(2);
+	auto handler = boost::make_shared<sharded_handler>();
+	ignoring_processor processor;
+
+	server::server_options options;
+	options.max_connections = 2;
+	auto acceptors = server::serve(pool, processor, handler, port, options);
+	std::thread pool_thread([&pool]{ pool.run(); });
+
+	// the clients, that are not accepted, wait in the backlog
+	boost::asio::io_service io_service;
+	std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> clients;
+	for (size_t i = 0; i < num_clients; ++i)
+	{
+		clients.emplace_back(new boost::asio::ip::tcp::socket(io_service));
+		clients.back()->connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+	}
+
+	BOOST_CHECK(wait_for([&handler]{ return handler->num_connected >= 2; }));
+
+	// each acceptor might accept one more connection, before it pauses
+	const size_t limit = options.max_connections + acceptors.size() - 1;
+	BOOST_CHECK(holds_for(std::chrono::milliseconds(50), [&handler, limit]{ return handler->num_connected <= limit; }));
+
+	// post() runs on the shard of the connection
+	std::vector<std::pair<sharded_handler::protocol_ptr, std::thread::id>> connections;
+	{
+		std::lock_guard<std::mutex> lock(handler->mutex);
+		connections.assign(handler->shards.begin(), handler->shards.end());
+	}
+
+	std::atomic<size_t> num_posted{0};
+	std::atomic<size_t> num_on_shard{0};
+	for (auto& connection : connections)
+	{
+		auto shard = connection.second;
+		server::post(connection.first, [&num_posted, &num_on_shard, shard]
+		{
+			if (std::this_thread::get_id() == shard)
+				++num_on_shard;
+			++num_posted;
+		});
+	}
+	BOOST_CHECK(wait_for([&]{ return num_posted == connections.size(); }));
+	BOOST_CHECK_EQUAL(num_on_shard.load(), connections.size());
+
+	// every closed connection lets the acceptors resume, until all clients were served
+	for (auto& client : clients)
+		client->close();
+
+	BOOST_CHECK(wait_for([&handler]{ return handler->num_disconnected == num_clients; }));
+	BOOST_CHECK_EQUAL(handler->num_connected.load(), num_clients);
+	BOOST_CHECK_LE(handler->max_live_connections, limit);
+
+	pool.stop();
+	pool_thread.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,11 +14,16 @@
 #include <thrift/protocol/TBinaryProtocol.h>
 
 #include <synchronous_service.h>
+#include <asynchronous_client.h>
 #include <betabugs/networking/thrift_asio_transport.hpp>
 #include <betabugs/networking/thrift_asio_server.hpp>
 #include <betabugs/networking/thrift_asio_client_transport.hpp>
+#include <betabugs/networking/thrift_asio_client.hpp>
+#include <betabugs/networking/thrift_asio_coroutine.hpp>
+#include <atomic>
 #include <thread>
 #include <future>
+#include <memory>
 
 class synchronous_service_handler : public test::synchronous_serviceIf
 								  , public betabugs::networking::thrift_asio_transport::event_handlers
@@ -87,6 +92,231 @@ struct test_event_handlers : public betabugs::networking::thrift_asio_transport:
 	}
 };
 
+/// remembers the threads, that before_process and add are called on
+class offloaded_service_handler : public synchronous_service_handler
+{
+  public:
+	std::atomic<std::thread::id> before_process_thread;
+	std::atomic<std::thread::id> add_thread;
+
+	virtual int32_t add(const int32_t a, const int32_t b) override
+	{
+		add_thread = std::this_thread::get_id();
+		return a + b;
+	}
+
+	void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		(void) output_protocol;
+		before_process_thread = std::this_thread::get_id();
+	}
+};
+
+/// completes add later, when complete_replies is called
+class deferred_service_handler : public test::synchronous_serviceCobSvIf
+							   , public betabugs::networking::thrift_asio_transport::event_handlers
+{
+  public:
+	std::vector<std::function<void()>> replies;
+
+	virtual void add(tcxx::function<void(int32_t const& _return)> cob, const int32_t a, const int32_t b) override
+	{
+		replies.push_back([cob, a, b]{ cob(a + b); });
+	}
+
+	/// replies in the reverse order of the requests
+	void complete_replies()
+	{
+		while (!replies.empty())
+		{
+			replies.back()();
+			replies.pop_back();
+		}
+	}
+
+	// functions called by thrift_asio_server
+	void on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		(void) output_protocol;
+	}
+
+	void on_client_disconnected(const boost::shared_ptr<apache::thrift::protocol::TProtocol>& output_protocol, const boost::system::error_code& ec)
+	{
+		(void) output_protocol;
+		(void) ec;
+	}
+
+	void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol> output_protocol)
+	{
+		(void) output_protocol;
+	}
+
+	void after_process()
+	{
+	}
+};
+
+/// calls synchronous_service::add without blocking
+class pipelining_client_handler : public betabugs::networking::thrift_asio_client<
+	test::synchronous_serviceClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::synchronous_serviceClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf
+	>::thrift_asio_client;
+
+	std::vector<std::future<int32_t>> results;
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+	}
+
+	virtual void on_connected() override
+	{
+		for (int32_t i = 0; i < 10; ++i)
+		{
+			results.push_back(async_call(
+				[i](test::synchronous_serviceClient& c){ c.send_add(i, i); },
+				[](test::synchronous_serviceClient& c){ return c.recv_add(); }
+			));
+		}
+	}
+};
+
+/// records the calls, that were still pending, when the connection was lost
+class disconnected_client_handler : public pipelining_client_handler
+{
+  public:
+	using pipelining_client_handler::pipelining_client_handler;
+
+	bool is_disconnected = false;
+	size_t pending_calls_on_error = 0;
+	size_t pending_calls_on_disconnected = 0;
+
+	virtual void on_error(const boost::system::error_code& ec) override
+	{
+		(void) ec;
+		pending_calls_on_error = pending_calls();
+	}
+
+	virtual void on_disconnected() override
+	{
+		is_disconnected = true;
+		pending_calls_on_disconnected = pending_calls();
+	}
+};
+
+/// calls add and blocks for the reply, from within the completion of an async_call
+class nesting_client_handler : public betabugs::networking::thrift_asio_client<
+	test::synchronous_serviceClient,
+	test::asynchronous_clientProcessor,
+	test::asynchronous_clientIf
+>
+{
+  public:
+	using betabugs::networking::thrift_asio_client<
+		test::synchronous_serviceClient,
+		test::asynchronous_clientProcessor,
+		test::asynchronous_clientIf
+	>::thrift_asio_client;
+
+	int32_t async_result = 0;
+	int32_t nested_result = 0;
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+	}
+
+	virtual void on_connected() override
+	{
+		async_call(
+			[](test::synchronous_serviceClient& c){ c.send_add(1, 1); },
+			[](test::synchronous_serviceClient& c){ return c.recv_add(); },
+			[this](std::future<int32_t> result)
+			{
+				async_result = result.get();
+				nested_result = client_.add(20, 22);
+			}
+		);
+	}
+};
+
+/// reads the calls, but never replies
+struct never_replying_processor : public apache::thrift::TProcessor
+{
+	int num_calls = 0;
+
+	virtual bool process(
+		boost::shared_ptr<apache::thrift::protocol::TProtocol>,
+		boost::shared_ptr<apache::thrift::protocol::TProtocol>,
+		void*
+	) override
+	{
+		++num_calls;
+		return true;
+	}
+};
+
+#ifdef THRIFT_ASIO_HAS_COROUTINES
+/// completes add from a coroutine, that continues on a worker thread
+class coroutine_service_handler : public deferred_service_handler
+{
+  public:
+	betabugs::networking::worker_pool workers{2};
+
+	virtual void add(tcxx::function<void(int32_t const& _return)> cob, const int32_t a, const int32_t b) override
+	{
+		add_on_worker(cob, a, b, workers);
+	}
+
+  private:
+	static betabugs::networking::detached_task add_on_worker(
+		tcxx::function<void(int32_t const& _return)> cob, int32_t a, int32_t b,
+		betabugs::networking::worker_pool& workers
+	)
+	{
+		co_await betabugs::networking::resume_on(workers);
+		cob(a + b);
+	}
+};
+
+/// chains calls to synchronous_service::add in a coroutine
+class coroutine_client_handler : public pipelining_client_handler
+{
+  public:
+	using pipelining_client_handler::pipelining_client_handler;
+
+	int32_t sum = 0;
+	bool is_done = false;
+
+	virtual void on_connected() override
+	{
+		add_twice();
+	}
+
+  private:
+	betabugs::networking::detached_task add_twice()
+	{
+		sum = co_await co_call(
+			[](test::synchronous_serviceClient& c){ c.send_add(20, 22); },
+			[](test::synchronous_serviceClient& c){ return c.recv_add(); }
+		);
+		sum = co_await co_call(
+			[this](test::synchronous_serviceClient& c){ c.send_add(sum, sum); },
+			[](test::synchronous_serviceClient& c){ return c.recv_add(); }
+		);
+		is_done = true;
+	}
+};
+#endif // THRIFT_ASIO_HAS_COROUTINES
+
 BOOST_AUTO_TEST_SUITE(test_synchrounous)
 
 BOOST_AUTO_TEST_CASE(test_synchrounous_basic)
@@ -154,4 +384,225 @@ BOOST_AUTO_TEST_CASE(test_synchrounous_basic)
 	BOOST_CHECK_GT(num_iterations, 0);
 }
 
+BOOST_AUTO_TEST_CASE(test_synchrounous_async_call)
+{
+	const unsigned short port = 1343;
+
+	auto handler = boost::make_shared<synchronous_service_handler>();
+	auto processor = test::synchronous_serviceProcessor(handler);
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<synchronous_service_handler>::serve(io_service, processor, handler, port);
+
+	pipelining_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+
+		// all calls are sent at once, before any reply arrived
+		if (!client_handler.results.empty() && client_handler.pending_calls() == 0)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+
+	BOOST_REQUIRE_EQUAL(client_handler.results.size(), 10u);
+	for (int32_t i = 0; i < 10; ++i)
+		BOOST_CHECK_EQUAL(client_handler.results[size_t(i)].get(), 2 * i);
+}
+
+BOOST_AUTO_TEST_CASE(test_synchrounous_deferred_replies)
+{
+	const unsigned short port = 1344;
+
+	auto handler = boost::make_shared<deferred_service_handler>();
+	auto processor = test::synchronous_serviceAsyncProcessor(handler);
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<deferred_service_handler>::server_options options;
+	options.max_pending_requests = 2;
+	betabugs::networking::thrift_asio_server<deferred_service_handler>::serve(io_service, processor, handler, port, options);
+
+	pipelining_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+
+		if (!client_handler.results.empty() && client_handler.pending_calls() == 0)
+			break;
+
+		// the server stops processing frames, while two requests are pending
+		BOOST_CHECK_LE(handler->replies.size(), 2u);
+		handler->complete_replies();
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+
+	// the replies arrived out of order, but are matched to the right calls
+	BOOST_REQUIRE_EQUAL(client_handler.results.size(), 10u);
+	for (int32_t i = 0; i < 10; ++i)
+		BOOST_CHECK_EQUAL(client_handler.results[size_t(i)].get(), 2 * i);
+}
+
+BOOST_AUTO_TEST_CASE(test_synchrounous_workers)
+{
+	const unsigned short port = 1345;
+
+	auto handler = boost::make_shared<offloaded_service_handler>();
+	auto processor = test::synchronous_serviceProcessor(handler);
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<offloaded_service_handler>::server_options options;
+	options.workers = std::make_shared<betabugs::networking::worker_pool>(2, 4);
+	options.offload = [](const std::string& method){ return method == "add"; };
+	betabugs::networking::thrift_asio_server<offloaded_service_handler>::serve(io_service, processor, handler, port, options);
+
+	pipelining_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+
+		if (!client_handler.results.empty() && client_handler.pending_calls() == 0)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+
+	BOOST_REQUIRE_EQUAL(client_handler.results.size(), 10u);
+	for (int32_t i = 0; i < 10; ++i)
+		BOOST_CHECK_EQUAL(client_handler.results[size_t(i)].get(), 2 * i);
+
+	// the handler ran on a worker, before_process on the thread of the io_service
+	BOOST_CHECK(handler->add_thread.load() != std::thread::id());
+	BOOST_CHECK(handler->add_thread.load() != std::this_thread::get_id());
+	BOOST_CHECK(handler->before_process_thread.load() == std::this_thread::get_id());
+
+	// a task is counted after it returned, so the workers are joined first
+	options.workers->stop();
+	BOOST_CHECK_EQUAL(options.workers->stats().tasks_executed, 10u);
+}
+
+BOOST_AUTO_TEST_CASE(test_synchrounous_server_lost)
+{
+	const unsigned short port = 1351;
+
+	auto handler = boost::make_shared<synchronous_service_handler>();
+	never_replying_processor processor;
+
+	std::unique_ptr<boost::asio::io_service> server_io_service(new boost::asio::io_service);
+	betabugs::networking::thrift_asio_server<synchronous_service_handler>::serve(*server_io_service, processor, handler, port);
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+	disconnected_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	// the server holds back the replies
+	int num_iterations = 5000 / 100;
+	while (--num_iterations && processor.num_calls < 10)
+	{
+		server_io_service->poll();
+		io_service.poll();
+		client_handler.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_REQUIRE_EQUAL(processor.num_calls, 10);
+	BOOST_CHECK_EQUAL(client_handler.pending_calls(), 10u);
+
+	// kill the server. Its connection is closed along with the io_service
+	server_io_service.reset();
+
+	num_iterations = 5000 / 100;
+	while (--num_iterations && !client_handler.is_disconnected)
+	{
+		io_service.poll();
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_REQUIRE(client_handler.is_disconnected);
+
+	// the calls failed, before the client's handlers were invoked
+	BOOST_CHECK_EQUAL(client_handler.pending_calls_on_error, 0u);
+	BOOST_CHECK_EQUAL(client_handler.pending_calls_on_disconnected, 0u);
+	BOOST_REQUIRE_EQUAL(client_handler.results.size(), 10u);
+	for (auto& result : client_handler.results)
+		BOOST_CHECK_THROW(result.get(), apache::thrift::transport::TTransportException);
+}
+
+BOOST_AUTO_TEST_CASE(test_synchrounous_nested_call)
+{
+	const unsigned short port = 1357;
+
+	auto handler = boost::make_shared<synchronous_service_handler>();
+	auto processor = test::synchronous_serviceProcessor(handler);
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<synchronous_service_handler>::serve(io_service, processor, handler, port);
+
+	nesting_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations && client_handler.nested_result == 0)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+
+	// the reply of the async_call was read, before its completion ran, so the nested call got its own
+	BOOST_CHECK_EQUAL(client_handler.async_result, 2);
+	BOOST_CHECK_EQUAL(client_handler.nested_result, 42);
+	BOOST_CHECK_EQUAL(client_handler.pending_calls(), 0u);
+}
+
+#ifdef THRIFT_ASIO_HAS_COROUTINES
+BOOST_AUTO_TEST_CASE(test_synchrounous_coroutines)
+{
+	const unsigned short port = 1346;
+
+	auto handler = boost::make_shared<coroutine_service_handler>();
+	auto processor = test::synchronous_serviceAsyncProcessor(handler);
+
+	boost::asio::io_service io_service;
+	boost::asio::io_service::work work(io_service);
+
+	betabugs::networking::thrift_asio_server<coroutine_service_handler>::serve(io_service, processor, handler, port);
+
+	coroutine_client_handler client_handler(io_service, "127.0.0.1", std::to_string(port));
+
+	int num_iterations = 5000 / 100;
+	while (--num_iterations)
+	{
+		while (io_service.poll_one())
+			client_handler.update();
+
+		if (client_handler.is_done)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	BOOST_CHECK_GT(num_iterations, 0);
+	BOOST_CHECK_EQUAL(client_handler.sum, 2 * (20 + 22));
+}
+#endif // THRIFT_ASIO_HAS_COROUTINES
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,80 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_worker_pool
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/worker_pool.hpp>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+BOOST_AUTO_TEST_SUITE(test_worker_pool)
+
+BOOST_AUTO_TEST_CASE(test_worker_pool_bounded_queue)
+{
+	betabugs::networking::worker_pool workers(2, 4);
+
+	// keep both workers busy, so that the queue fills up
+	std::promise<void> release;
+	auto released = release.get_future().share();
+	std::atomic<int> num_executed(0);
+	auto task = [released, &num_executed]{ released.wait(); ++num_executed; };
+
+	BOOST_CHECK(workers.post(task));
+	BOOST_CHECK(workers.post(task));
+	while (workers.stats().queue_depth != 0)
+		std::this_thread::yield();
+
+	BOOST_CHECK(workers.post(task));
+	BOOST_CHECK(workers.post(task));
+	BOOST_CHECK(workers.post(task));
+	BOOST_CHECK(!workers.post(task)); // the fourth queued task reaches max_queue_depth
+	BOOST_CHECK(!workers.has_capacity());
+
+	std::promise<void> capacity;
+	workers.async_wait_for_capacity([&capacity]{ capacity.set_value(); });
+
+	release.set_value();
+	BOOST_CHECK(capacity.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+	// tasks_executed is counted after the task returned, so wait for the pool's own counter
+	while (workers.stats().tasks_executed != 6)
+		std::this_thread::yield();
+	BOOST_CHECK_EQUAL(num_executed, 6);
+
+	auto stats = workers.stats();
+	BOOST_CHECK_EQUAL(stats.tasks_executed, 6u);
+	BOOST_CHECK_EQUAL(stats.peak_queue_depth, 4u);
+	BOOST_CHECK_EQUAL(stats.overflow_count, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_worker_pool_stop_runs_queued_tasks)
+{
+	betabugs::networking::worker_pool workers(1);
+
+	// the worker is busy, while the other tasks are queued
+	std::promise<void> release;
+	auto released = release.get_future().share();
+	std::atomic<int> num_executed(0);
+	workers.post([released, &num_executed]{ released.wait(); ++num_executed; });
+	for (int i = 0; i < 10; ++i)
+		workers.post([&num_executed]{ ++num_executed; });
+
+	std::thread stopper([&workers]{ workers.stop(); });
+	release.set_value();
+	stopper.join();
+	BOOST_CHECK_EQUAL(num_executed, 11);
+	BOOST_CHECK_EQUAL(workers.stats().queue_depth, 0u);
+
+	// tasks posted after stop() are run by the caller
+	const auto caller = std::this_thread::get_id();
+	std::thread::id executor;
+	workers.post([&executor]{ executor = std::this_thread::get_id(); });
+	BOOST_CHECK(executor == caller);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
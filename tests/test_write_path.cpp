@@ -0,0 +1,64 @@
+#ifndef BOOST_TEST_MODULE
+#	define BOOST_TEST_MODULE test_write_path
+#	define BOOST_TEST_DYN_LINK
+
+#	include <boost/test/unit_test.hpp>
+
+#endif /* BOOST_TEST_MODULE */
+
+#include <betabugs/networking/thrift_asio_transport.hpp>
+#include <boost/asio/read.hpp>
+#include <algorithm>
+#include <string>
+
+BOOST_AUTO_TEST_SUITE(test_write_path)
+
+using betabugs::networking::thrift_asio_transport;
+
+BOOST_AUTO_TEST_CASE(test_write_path_gathered_and_pooled_buffers)
+{
+	boost::asio::io_service io_service;
+	boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	auto socket = std::make_shared<boost::asio::ip::tcp::socket>(io_service);
+	boost::asio::ip::tcp::socket peer(io_service);
+	peer.connect(acceptor.local_endpoint());
+	acceptor.accept(*socket);
+
+	thrift_asio_transport::event_handlers handlers;
+	auto transport = boost::make_shared<thrift_asio_transport>(socket, &handlers);
+
+	// a copied message, a buffer, that is only owned by the transport, and one, that is shared
+	const std::string copied = "copied ";
+	transport->write(reinterpret_cast<const uint8_t*>(copied.data()), uint32_t(copied.size()));
+
+	auto owned = transport->acquire_buffer();
+	owned->assign({'o', 'w', 'n', 'e', 'd', ' '});
+	const auto owned_storage = owned.get();
+	transport->write(thrift_asio_transport::shared_buffer(std::move(owned)));
+
+	auto shared = std::make_shared<std::vector<uint8_t>>(std::initializer_list<uint8_t>{'s', 'h', 'a', 'r', 'e', 'd'});
+	transport->write(thrift_asio_transport::shared_buffer(shared));
+
+	// are sent in order
+	while (transport->outbound_bytes() != 0)
+		io_service.run_one();
+
+	std::string received(copied.size() + 6 + shared->size(), '\0');
+	boost::asio::read(peer, boost::asio::buffer(&received[0], received.size()));
+	BOOST_CHECK_EQUAL(received, "copied owned shared");
+
+	// the sent buffers, that nobody else holds, are returned to the pool, emptied
+	std::vector<std::shared_ptr<std::vector<uint8_t>>> pooled;
+	for (int i = 0; i < 3; ++i)
+		pooled.push_back(transport->acquire_buffer());
+
+	BOOST_CHECK(std::any_of(pooled.begin(), pooled.end(),
+		[owned_storage](const std::shared_ptr<std::vector<uint8_t>>& b){ return b.get() == owned_storage; }));
+	BOOST_CHECK(std::none_of(pooled.begin(), pooled.end(),
+		[&shared](const std::shared_ptr<std::vector<uint8_t>>& b){ return b == shared; }));
+	for (auto& buffer : pooled)
+		BOOST_CHECK(buffer->empty());
+	BOOST_CHECK_EQUAL(shared->size(), 6u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
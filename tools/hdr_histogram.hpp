@@ -0,0 +1,136 @@
+#ifndef _THRIFT_ASIO_HDR_HISTOGRAM_HPP_
+#define _THRIFT_ASIO_HDR_HISTOGRAM_HPP_
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace tools {
+
+/*!
+* A high dynamic range histogram, like HdrHistogram.
+*
+* Values from 1 to highest_trackable_value are recorded with a relative error of
+* at most 1/1024 (three significant decimal digits), using a fixed amount of memory
+* and constant time per value. Histograms with the same highest_trackable_value
+* can be merged, i.e. those of several threads.
+*
+* The buckets are powers of two, each of them split into sub_bucket_half_count
+* linear sub-buckets. The first bucket covers 0..sub_bucket_count linearly.
+* */
+class hdr_histogram
+{
+  public:
+	static constexpr int sub_bucket_half_count_magnitude = 10;
+	static constexpr int64_t sub_bucket_half_count = int64_t(1) << sub_bucket_half_count_magnitude;
+	static constexpr int64_t sub_bucket_count = 2 * sub_bucket_half_count;
+
+	/// values above highest_trackable_value are recorded as highest_trackable_value
+	explicit hdr_histogram(int64_t highest_trackable_value = int64_t(3600) * 1000 * 1000 * 1000)
+		: highest_trackable_value_(std::max(highest_trackable_value, sub_bucket_count))
+		, total_count_(0)
+		, min_(0)
+		, max_(0)
+		, sum_(0)
+	{
+		int bucket_count = 1;
+		while ((sub_bucket_count << (bucket_count - 1)) <= highest_trackable_value_)
+			++bucket_count;
+		counts_.resize(size_t((bucket_count + 1) * sub_bucket_half_count));
+	}
+
+	void record(int64_t value)
+	{
+		value = std::min(std::max<int64_t>(value, 0), highest_trackable_value_);
+
+		++counts_[counts_index(value)];
+		min_ = total_count_ == 0 ? value : std::min(min_, value);
+		max_ = std::max(max_, value);
+		sum_ += double(value);
+		++total_count_;
+	}
+
+	/// adds the values of other, which must have the same highest_trackable_value
+	void merge(const hdr_histogram& other)
+	{
+		assert(counts_.size() == other.counts_.size());
+		if (other.total_count_ == 0)
+			return;
+
+		for (size_t i = 0; i < counts_.size(); ++i)
+			counts_[i] += other.counts_[i];
+
+		min_ = total_count_ == 0 ? other.min_ : std::min(min_, other.min_);
+		max_ = std::max(max_, other.max_);
+		sum_ += other.sum_;
+		total_count_ += other.total_count_;
+	}
+
+	/// the value, that percentile (0..100) of the recorded values did not exceed
+	int64_t value_at_percentile(double percentile) const
+	{
+		if (total_count_ == 0)
+			return 0;
+
+		auto target = uint64_t(std::ceil(std::min(percentile, 100.0) / 100.0 * double(total_count_)));
+		target = std::max<uint64_t>(target, 1);
+
+		uint64_t count = 0;
+		for (size_t i = 0; i < counts_.size(); ++i)
+		{
+			count += counts_[i];
+			if (count >= target)
+				return std::min(highest_equivalent_value(i), max_);
+		}
+		return max_;
+	}
+
+	uint64_t count() const { return total_count_; }
+	int64_t min() const { return min_; }
+	int64_t max() const { return max_; }
+	double mean() const { return total_count_ == 0 ? 0 : sum_ / double(total_count_); }
+
+  private:
+	int64_t highest_trackable_value_;
+	std::vector<uint64_t> counts_;
+	uint64_t total_count_;
+	int64_t min_;
+	int64_t max_;
+	double sum_;
+
+	static int bucket_index(int64_t value)
+	{
+		// the position of the highest bit, but at least that of sub_bucket_count
+		int pow2_ceiling = 64 - __builtin_clzll(uint64_t(value) | uint64_t(sub_bucket_count - 1));
+		return pow2_ceiling - (sub_bucket_half_count_magnitude + 1);
+	}
+
+	static size_t counts_index(int64_t value)
+	{
+		int bucket = bucket_index(value);
+		int64_t sub_bucket = value >> bucket;
+		return size_t(((int64_t(bucket) + 1) << sub_bucket_half_count_magnitude) + sub_bucket - sub_bucket_half_count);
+	}
+
+	// the highest value, that is counted at index
+	static int64_t highest_equivalent_value(size_t index)
+	{
+		auto i = int64_t(index);
+		int64_t bucket = (i >> sub_bucket_half_count_magnitude) - 1;
+		int64_t sub_bucket = (i & (sub_bucket_half_count - 1)) + sub_bucket_half_count;
+		if (bucket < 0)
+		{
+			bucket = 0;
+			sub_bucket -= sub_bucket_half_count;
+		}
+		return ((sub_bucket + 1) << bucket) - 1;
+	}
+};
+
+}
+
+#endif //_THRIFT_ASIO_HDR_HISTOGRAM_HPP_
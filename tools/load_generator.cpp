@@ -0,0 +1,554 @@
+/*!
+* \file
+* Opens many thrift_asio_client connections from one process and drives traffic
+* through them at a fixed rate, to find out how many clients a server can handle.
+*
+* The connections are distributed over --threads threads. Each thread runs its own
+* io_service and calls update() on its connections, like a single client would.
+*
+* Calls are scheduled open-loop: call k of a thread is due at start + k / rate, no matter
+* whether earlier calls were answered. Latencies are measured from the time a call was due,
+* not from when it was actually sent, so a generator, that falls behind, shows up in the
+* latencies instead of silently lowering the rate (coordinated omission).
+*
+* Workloads:
+*  - chat:    chat_server::broadcast_message, i.e. against example_server. The latency is
+*             measured per delivered on_message, so every call is counted once per other client.
+*  - oneway:  asynchronous_server::add, answered with the oneway asynchronous_client::on_added
+*  - request: synchronous_service::add, sent with thrift_asio_client::async_call
+*
+* The test.thrift services have no server of their own, so --serve starts one in-process.
+*
+* @code
+* ./example_server &
+* ./load_generator --workload chat --port 1528 --connections 1000 --rate 2000 --duration 30
+* ./load_generator --workload request --serve --connections 10000 --threads 4 --rate 100000
+* @endcode
+*
+* Opening thousands of connections needs a high enough limit of open files (ulimit -n).
+* */
+
+#include <betabugs/networking/thrift_asio_client.hpp>
+#include <betabugs/networking/thrift_asio_server.hpp>
+#include <betabugs/networking/thrift_asio_connection_management_mixin.hpp>
+#include <betabugs/networking/io_service_pool.hpp>
+#include <asynchronous_server.h>
+#include <asynchronous_client.h>
+#include <synchronous_service.h>
+#include <chat_server.h>
+#include <chat_client.h>
+#include "./hdr_histogram.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h> // getpid
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+struct options
+{
+	std::string host = "127.0.0.1";
+	unsigned short port = 1528;
+	std::string workload = "chat";
+	size_t connections = 100;
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	double rate = 1000;  ///< calls per second, over all connections
+	double duration = 10; ///< seconds
+	bool serve = false;
+	std::string json_path;
+};
+
+/// what one thread counted
+struct thread_stats
+{
+	tools::hdr_histogram latencies; ///< nanoseconds
+	uint64_t sent = 0;
+	uint64_t received = 0;
+	uint64_t errors = 0;      ///< calls, that failed
+	uint64_t disconnects = 0;
+
+	void record(clock_type::time_point due)
+	{
+		latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - due).count());
+		++received;
+	}
+};
+
+/// a connection, that the load generator sends calls through
+struct load_connection
+{
+	virtual ~load_connection() {}
+
+	/// true, once the connection can send calls
+	virtual bool is_ready() const = 0;
+
+	/// sends a call, that was due at due
+	virtual void send(clock_type::time_point due) = 0;
+
+	/// processes the received frames
+	virtual void poll() = 0;
+};
+
+/// mixes load_connection into a thrift_asio_client, see the workloads below
+template <typename ClientType, typename ProcessorType, typename HandlerInterfaceType>
+class load_client
+	: public betabugs::networking::thrift_asio_client<ClientType, ProcessorType, HandlerInterfaceType>
+	, public load_connection
+{
+	typedef betabugs::networking::thrift_asio_client<ClientType, ProcessorType, HandlerInterfaceType> base_type;
+
+  public:
+	load_client(boost::asio::io_service& io_service, const options& o, thread_stats& stats)
+		: base_type(io_service, o.host, std::to_string(o.port))
+		, stats_(stats)
+		, is_connected_(false)
+	{
+	}
+
+	virtual bool is_ready() const override
+	{
+		return is_connected_;
+	}
+
+	virtual void poll() override
+	{
+		this->update();
+	}
+
+	virtual void on_connected() override
+	{
+		is_connected_ = true;
+	}
+
+	virtual void on_disconnected() override
+	{
+		if (is_connected_)
+			++stats_.disconnects;
+		is_connected_ = false;
+	}
+
+  protected:
+	thread_stats& stats_;
+	bool is_connected_;
+};
+
+/// asynchronous_server::add, answered in order by asynchronous_client::on_added
+class oneway_client : public load_client<
+	test::asynchronous_serverClient, test::asynchronous_clientProcessor, test::asynchronous_clientIf
+>
+{
+  public:
+	using load_client::load_client;
+
+	virtual void send(clock_type::time_point due) override
+	{
+		in_flight_.push_back(due);
+		client_.add(int32_t(in_flight_.size()), 0);
+	}
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+		if (in_flight_.empty())
+			return;
+		stats_.record(in_flight_.front());
+		in_flight_.pop_front();
+	}
+
+  private:
+	std::deque<clock_type::time_point> in_flight_;
+};
+
+/// synchronous_service::add, matched to its reply by async_call
+class request_client : public load_client<
+	test::synchronous_serviceClient, test::asynchronous_clientProcessor, test::asynchronous_clientIf
+>
+{
+  public:
+	using load_client::load_client;
+
+	virtual void send(clock_type::time_point due) override
+	{
+		thread_stats& stats = stats_;
+		async_call(
+			[](test::synchronous_serviceClient& c){ c.send_add(20, 22); },
+			[](test::synchronous_serviceClient& c){ return c.recv_add(); },
+			[&stats, due](std::future<int32_t> result)
+			{
+				try
+				{
+					result.get();
+					stats.record(due);
+				}
+				catch (const std::exception&)
+				{
+					++stats.errors;
+				}
+			}
+		);
+	}
+
+	virtual void on_added(const int32_t result) override
+	{
+		(void)result;
+	}
+};
+
+/// chat_server::broadcast_message. The message is the time, that the call was due.
+class chat_client : public load_client<
+	example::chat::chat_serverClient, example::chat::chat_clientProcessor, example::chat::chat_clientIf
+>
+{
+  public:
+	chat_client(boost::asio::io_service& io_service, const options& o, thread_stats& stats, const std::string& user_name)
+		: load_client(io_service, o, stats)
+		, user_name_(user_name)
+		, has_user_name_(false)
+	{
+	}
+
+	virtual bool is_ready() const override
+	{
+		return is_connected_ && has_user_name_;
+	}
+
+	virtual void send(clock_type::time_point due) override
+	{
+		client_.broadcast_message(std::to_string(due.time_since_epoch().count()));
+	}
+
+	virtual void on_connected() override
+	{
+		load_client::on_connected();
+		client_.set_user_name(user_name_);
+	}
+
+	virtual void on_set_user_name_failed(const std::string& why) override
+	{
+		std::clog << user_name_ << ": " << why << std::endl;
+	}
+
+	virtual void on_set_user_name_succeeded() override
+	{
+		has_user_name_ = true;
+	}
+
+	virtual void on_message(const std::string& from_user, const std::string& message) override
+	{
+		(void)from_user;
+		clock_type::duration due(std::strtoll(message.c_str(), nullptr, 10));
+		stats_.record(clock_type::time_point(due));
+	}
+
+	virtual void on_send_message_failed(const std::string& why) override
+	{
+		(void)why;
+	}
+
+  private:
+	std::string user_name_;
+	bool has_user_name_;
+};
+
+std::unique_ptr<load_connection> make_connection(
+	boost::asio::io_service& io_service, const options& o, thread_stats& stats, size_t index
+)
+{
+	if (o.workload == "oneway")
+		return std::unique_ptr<load_connection>(new oneway_client(io_service, o, stats));
+	if (o.workload == "request")
+		return std::unique_ptr<load_connection>(new request_client(io_service, o, stats));
+
+	auto user_name = "load_generator-" + std::to_string(::getpid()) + "-" + std::to_string(index);
+	return std::unique_ptr<load_connection>(new chat_client(io_service, o, stats, user_name));
+}
+
+/// runs the connections of one thread
+class load_thread
+{
+  public:
+	load_thread(const options& o, size_t first_connection, size_t num_connections)
+		: options_(o)
+		, first_connection_(first_connection)
+		, num_connections_(num_connections)
+	{
+	}
+
+	/// connects, waits for start_time and sends until end_time
+	void run(std::atomic<size_t>& num_ready, clock_type::time_point start_time, clock_type::time_point end_time)
+	{
+		boost::asio::io_service io_service;
+		std::vector<std::unique_ptr<load_connection>> connections;
+		for (size_t i = 0; i < num_connections_; ++i)
+			connections.push_back(make_connection(io_service, options_, stats, first_connection_ + i));
+
+		// connect everybody, before the clock starts
+		size_t ready = 0;
+		while (clock_type::now() < start_time)
+		{
+			poll(io_service, connections);
+
+			size_t now_ready = 0;
+			for (auto& c : connections)
+				now_ready += c->is_ready();
+			num_ready += now_ready - ready;
+			ready = now_ready;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		const double calls_per_thread = options_.rate * double(num_connections_) / double(options_.connections);
+		const auto interval = std::chrono::duration_cast<clock_type::duration>(
+			std::chrono::duration<double>(1.0 / calls_per_thread)
+		);
+
+		uint64_t k = 0;
+		size_t next_connection = 0;
+		const auto drain_time = end_time + std::chrono::seconds(1);
+		for (;;)
+		{
+			auto now = clock_type::now();
+			if (now >= drain_time)
+				break;
+
+			// send everything, that is due, even if that is late
+			auto due = start_time + interval * k;
+			while (due <= now && due < end_time)
+			{
+				auto& connection = connections[next_connection];
+				next_connection = (next_connection + 1) % connections.size();
+				if (connection->is_ready())
+				{
+					connection->send(due);
+					++stats.sent;
+				}
+				due = start_time + interval * ++k;
+			}
+
+			if (!poll(io_service, connections) && due > clock_type::now() + std::chrono::microseconds(100))
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+
+	thread_stats stats;
+
+  private:
+	const options& options_;
+	size_t first_connection_;
+	size_t num_connections_;
+
+	// returns true, if there was something to do
+	static bool poll(boost::asio::io_service& io_service, std::vector<std::unique_ptr<load_connection>>& connections)
+	{
+		bool did_something = false;
+		while (io_service.poll_one())
+			did_something = true;
+		for (auto& c : connections)
+			c->poll();
+		return did_something;
+	}
+};
+
+/// answers asynchronous_server::add with asynchronous_client::on_added
+class oneway_server_handler : public test::asynchronous_serverIf
+							, public betabugs::networking::thrift_asio_transport::event_handlers
+							, public betabugs::networking::thrift_asio_connection_management_mixin<test::asynchronous_clientClient>
+{
+  public:
+	virtual void add(const int32_t a, const int32_t b) override
+	{
+		current_client_->on_added(a + b);
+	}
+};
+
+class request_server_handler : public test::synchronous_serviceIf
+							 , public betabugs::networking::thrift_asio_transport::event_handlers
+{
+  public:
+	virtual int32_t add(const int32_t a, const int32_t b) override
+	{
+		return a + b;
+	}
+
+	void on_client_connected(boost::shared_ptr<apache::thrift::protocol::TProtocol>) {}
+	void on_client_disconnected(const boost::shared_ptr<apache::thrift::protocol::TProtocol>&, const boost::system::error_code&) {}
+	void before_process(boost::shared_ptr<apache::thrift::protocol::TProtocol>) {}
+	void after_process() {}
+};
+
+/// serves the test.thrift service of the workload on a pool, until stop() is called
+class in_process_server
+{
+  public:
+	explicit in_process_server(const options& o)
+		: pool_(std::max<size_t>(1, o.threads / 2))
+	{
+		using betabugs::networking::thrift_asio_server;
+
+		if (o.workload == "oneway")
+		{
+			auto handler = boost::make_shared<oneway_server_handler>();
+			processor_.reset(new test::asynchronous_serverProcessor(handler));
+			thrift_asio_server<oneway_server_handler>::serve(pool_, *processor_, handler, o.port);
+		}
+		else
+		{
+			auto handler = boost::make_shared<request_server_handler>();
+			processor_.reset(new test::synchronous_serviceProcessor(handler));
+			thrift_asio_server<request_server_handler>::serve(pool_, *processor_, handler, o.port);
+		}
+
+		thread_ = std::thread([this]{ pool_.run(); });
+	}
+
+	~in_process_server()
+	{
+		pool_.stop();
+		thread_.join();
+	}
+
+  private:
+	betabugs::networking::io_service_pool pool_;
+	std::unique_ptr<apache::thrift::TProcessor> processor_;
+	std::thread thread_;
+};
+
+void usage()
+{
+	std::cerr
+		<< "usage: load_generator [options]\n"
+		<< "  --host <host>           server to connect to (127.0.0.1)\n"
+		<< "  --port <port>           (1528, the port of example_server)\n"
+		<< "  --workload <name>       chat, oneway or request (chat)\n"
+		<< "  --connections <n>       number of connections (100)\n"
+		<< "  --threads <n>           threads, that drive the connections (one per core)\n"
+		<< "  --rate <calls/s>        target rate over all connections (1000)\n"
+		<< "  --duration <seconds>    how long to send (10)\n"
+		<< "  --serve                 serve the oneway or request workload in-process\n"
+		<< "  --json <file>           also write the results as JSON to file\n";
+}
+
+bool parse(int argc, char** argv, options& o)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+
+		if (arg == "--help") return false;
+		else if (arg == "--serve") o.serve = true;
+		else if (!has_value) return false;
+		else if (arg == "--host") o.host = argv[++i];
+		else if (arg == "--port") o.port = (unsigned short)std::atoi(argv[++i]);
+		else if (arg == "--workload") o.workload = argv[++i];
+		else if (arg == "--connections") o.connections = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--threads") o.threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--rate") o.rate = std::atof(argv[++i]);
+		else if (arg == "--duration") o.duration = std::atof(argv[++i]);
+		else if (arg == "--json") o.json_path = argv[++i];
+		else return false;
+	}
+
+	if (o.workload != "chat" && o.workload != "oneway" && o.workload != "request")
+		return false;
+	if (o.serve && o.workload == "chat")
+		return false;
+
+	o.threads = std::max<size_t>(1, std::min(o.threads, o.connections));
+	return o.connections > 0 && o.rate > 0 && o.duration > 0;
+}
+
+void write_report(std::ostream& out, const options& o, const thread_stats& total, size_t num_ready, double seconds)
+{
+	const auto& h = total.latencies;
+	auto us = [](int64_t ns){ return double(ns) / 1000.0; };
+
+	out << "{\"workload\": \"" << o.workload << "\""
+		<< ", \"connections\": " << o.connections
+		<< ", \"connected\": " << num_ready
+		<< ", \"threads\": " << o.threads
+		<< ", \"target_rate\": " << o.rate
+		<< ", \"seconds\": " << seconds
+		<< ", \"sent\": " << total.sent
+		<< ", \"received\": " << total.received
+		<< ", \"errors\": " << total.errors
+		<< ", \"disconnects\": " << total.disconnects
+		<< ", \"sent_per_second\": " << double(total.sent) / seconds
+		<< ", \"received_per_second\": " << double(total.received) / seconds
+		<< ", \"latency_us\": {"
+		<< "\"min\": " << us(h.min())
+		<< ", \"mean\": " << h.mean() / 1000.0
+		<< ", \"p50\": " << us(h.value_at_percentile(50))
+		<< ", \"p90\": " << us(h.value_at_percentile(90))
+		<< ", \"p99\": " << us(h.value_at_percentile(99))
+		<< ", \"p999\": " << us(h.value_at_percentile(99.9))
+		<< ", \"p9999\": " << us(h.value_at_percentile(99.99))
+		<< ", \"max\": " << us(h.max())
+		<< "}}" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	options o;
+	if (!parse(argc, argv, o))
+	{
+		usage();
+		return 1;
+	}
+
+	std::unique_ptr<in_process_server> server;
+	if (o.serve)
+		server.reset(new in_process_server(o));
+
+	// give everybody some time to connect, before sending starts
+	const auto start_time = clock_type::now() + std::chrono::seconds(2) + std::chrono::milliseconds(o.connections / 2);
+	const auto end_time = start_time + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(o.duration));
+
+	std::atomic<size_t> num_ready(0);
+	std::vector<std::unique_ptr<load_thread>> load_threads;
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < o.threads; ++i)
+	{
+		size_t first = o.connections * i / o.threads;
+		size_t last = o.connections * (i + 1) / o.threads;
+		load_threads.emplace_back(new load_thread(o, first, last - first));
+
+		auto& t = *load_threads.back();
+		threads.emplace_back([&t, &num_ready, start_time, end_time]{ t.run(num_ready, start_time, end_time); });
+	}
+
+	for (auto& t : threads)
+		t.join();
+
+	thread_stats total;
+	for (auto& t : load_threads)
+	{
+		total.latencies.merge(t->stats.latencies);
+		total.sent += t->stats.sent;
+		total.received += t->stats.received;
+		total.errors += t->stats.errors;
+		total.disconnects += t->stats.disconnects;
+	}
+
+	write_report(std::cout, o, total, num_ready, o.duration);
+	if (!o.json_path.empty())
+	{
+		std::ofstream file(o.json_path);
+		write_report(file, o, total, num_ready, o.duration);
+	}
+
+	return 0;
+}